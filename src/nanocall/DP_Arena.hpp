@@ -0,0 +1,202 @@
+#ifndef __DP_ARENA_HPP
+#define __DP_ARENA_HPP
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <map>
+#include <new>
+#include <vector>
+
+#ifdef __linux__
+#include <sys/mman.h>
+#endif
+
+/*
+ * Per-thread cache of large memory blocks, for DP matrices.
+ *
+ * A block released by a thread is kept in that thread's cache, and handed out again
+ * to the next request of that thread that it fits (if not more than twice too large).
+ * Across reads, DP matrices thus reuse memory that is already mapped, instead of
+ * allocating and page-faulting it again. The caches of all threads together hold
+ * at most max_cached_bytes() (0: no caching); a thread over the cap makes room by
+ * dropping its own smallest blocks, and frees the block if that is not enough.
+ * The cache of a thread is freed when the thread exits.
+ * Block sizes are rounded up to eighths of powers of 2, so that strands of similar
+ * length share blocks. With huge_pages(), blocks of at least 2MB are aligned
+ * to 2MB, and advised to be backed by transparent huge pages.
+ * Arena buffers must not outlive their thread, e.g. they cannot be held by
+ * thread_local objects.
+ *
+ * Requests under min_block_bytes go to operator new.
+ */
+class DP_Arena
+{
+public:
+    static const size_t min_block_bytes = 1u << 16;
+    static const size_t huge_page_bytes = 1u << 21;
+
+    static size_t& max_cached_bytes() { static size_t _max_cached_bytes = size_t(512) << 20; return _max_cached_bytes; }
+    static bool& huge_pages() { static bool _huge_pages = false; return _huge_pages; }
+
+    static void* allocate(size_t n_bytes)
+    {
+        if (n_bytes < min_block_bytes)
+        {
+            return ::operator new(n_bytes);
+        }
+        Cache& c = cache();
+        auto it = c.block_m.lower_bound(n_bytes);
+        if (it != c.block_m.end() and it->first <= 2 * n_bytes)
+        {
+            void* p = it->second;
+            c.cached_bytes -= it->first;
+            total_cached_bytes_ref() -= it->first;
+            c.block_m.erase(it);
+            return p;
+        }
+        return new_block(block_size(n_bytes));
+    }
+
+    static void deallocate(void* p, size_t n_bytes)
+    {
+        if (n_bytes < min_block_bytes)
+        {
+            ::operator delete(p);
+            return;
+        }
+        size_t size = header(p)->size;
+        Cache& c = cache();
+        if (size > max_cached_bytes())
+        {
+            free_block(p);
+            return;
+        }
+        // make room by dropping the smallest blocks of this thread
+        auto& total = total_cached_bytes_ref();
+        while (not c.block_m.empty() and total + size > max_cached_bytes())
+        {
+            auto it = c.block_m.begin();
+            c.cached_bytes -= it->first;
+            total -= it->first;
+            free_block(it->second);
+            c.block_m.erase(it);
+        }
+        // reserve room under the global cap, which other threads may have taken meanwhile
+        size_t crt_total = total.load();
+        do
+        {
+            if (crt_total + size > max_cached_bytes())
+            {
+                free_block(p);
+                return;
+            }
+        } while (not total.compare_exchange_weak(crt_total, crt_total + size));
+        c.block_m.emplace(size, p);
+        c.cached_bytes += size;
+    }
+
+    // bytes held by the cache of the calling thread
+    static size_t cached_bytes() { return cache().cached_bytes; }
+    // bytes held by the caches of all threads
+    static size_t total_cached_bytes() { return total_cached_bytes_ref(); }
+
+private:
+    // blocks start with a header, padded to keep the data 64-byte aligned
+    struct Header
+    {
+        void* base;
+        size_t size;
+    };
+    static const size_t header_bytes = 64;
+
+    struct Cache
+    {
+        std::multimap< size_t, void* > block_m;
+        size_t cached_bytes = 0;
+        ~Cache()
+        {
+            for (const auto& p : block_m)
+            {
+                free_block(p.second);
+            }
+            total_cached_bytes_ref() -= cached_bytes;
+        }
+    };
+
+    static std::atomic< size_t >& total_cached_bytes_ref()
+    {
+        static std::atomic< size_t > _total_cached_bytes(0);
+        return _total_cached_bytes;
+    }
+
+    static Cache& cache()
+    {
+        static thread_local Cache _cache;
+        return _cache;
+    }
+
+    static Header* header(void* p)
+    {
+        return reinterpret_cast< Header* >(static_cast< char* >(p) - header_bytes);
+    }
+
+    // round up to the next size of the form 2^k * m / 8, with 8 <= m < 16
+    static size_t block_size(size_t n_bytes)
+    {
+        size_t k = 1;
+        while ((k << 3) <= n_bytes) k <<= 1;
+        k >>= 1;
+        return ((n_bytes + k - 1) / k) * k;
+    }
+
+    static void* new_block(size_t size)
+    {
+        bool huge = huge_pages() and size >= huge_page_bytes;
+        void* base = nullptr;
+        if (posix_memalign(&base, huge? size_t(huge_page_bytes) : size_t(header_bytes), header_bytes + size) != 0)
+        {
+            throw std::bad_alloc();
+        }
+#if defined(__linux__) && defined(MADV_HUGEPAGE)
+        if (huge)
+        {
+            madvise(base, header_bytes + size, MADV_HUGEPAGE);
+        }
+#endif
+        void* p = static_cast< char* >(base) + header_bytes;
+        header(p)->base = base;
+        header(p)->size = size;
+        return p;
+    }
+
+    static void free_block(void* p)
+    {
+        std::free(header(p)->base);
+    }
+}; // class DP_Arena
+
+// std allocator drawing large buffers from DP_Arena
+template < typename T >
+struct DP_Arena_Allocator
+{
+    typedef T value_type;
+
+    DP_Arena_Allocator() = default;
+    template < typename U >
+    DP_Arena_Allocator(const DP_Arena_Allocator< U >&) {}
+
+    T* allocate(size_t n) { return static_cast< T* >(DP_Arena::allocate(n * sizeof(T))); }
+    void deallocate(T* p, size_t n) { DP_Arena::deallocate(p, n * sizeof(T)); }
+
+    template < typename U >
+    bool operator == (const DP_Arena_Allocator< U >&) const { return true; }
+    template < typename U >
+    bool operator != (const DP_Arena_Allocator< U >&) const { return false; }
+}; // struct DP_Arena_Allocator
+
+template < typename T >
+using DP_Arena_Vector = std::vector< T, DP_Arena_Allocator< T > >;
+
+#endif
@@ -0,0 +1,81 @@
+#ifndef __EMISSION_MATRIX_HPP
+#define __EMISSION_MATRIX_HPP
+
+#include <algorithm>
+#include <cassert>
+#include <cstddef>
+
+#include "Pore_Model.hpp"
+#include "DP_Arena.hpp"
+
+/*
+ * Corrected emissions of a window of events for all states of a scaled model.
+ *
+ * The matrix is filled once per (scaled model, corrected events), and passed to every
+ * DP engine run on them, which would otherwise each recompute the emissions (the
+ * backward pass and the transition training, once per transition). It is the caller's
+ * responsibility to pass it only with the model and events it was filled from.
+ * Windows larger than max_mb() are not stored; engines then compute emissions on the fly.
+ * The budget is per matrix, so it is kept small: a matrix is reused from one sequence
+ * to the next, and emissions of long sequences are recomputed by the passes instead.
+ * Emissions are always exact, regardless of Pore_Model::sparse_emission_stdvs().
+ */
+template < typename Float_Type, unsigned Kmer_Size = 6 >
+class Emission_Matrix
+{
+public:
+    typedef Pore_Model< Float_Type, Kmer_Size > Pore_Model_Type;
+    typedef Event_Sequence< Float_Type, Kmer_Size > Event_Sequence_Type;
+
+    static const unsigned n_states = Pore_Model_Type::n_states;
+
+    // largest matrix kept, in MB; 0: never keep a matrix
+    static size_t& max_mb() { static size_t _max_mb = 16; return _max_mb; }
+
+    static bool fits(unsigned n_events)
+    {
+        return static_cast< size_t >(n_events) * n_states * sizeof(Float_Type) <= (max_mb() << 20);
+    }
+
+    Emission_Matrix() : _i_begin(0), _n_events(0) {}
+
+    void clear() { _m.clear(); _i_begin = 0; _n_events = 0; }
+    bool empty() const { return _n_events == 0; }
+    unsigned i_begin() const { return _i_begin; }
+    unsigned n_events() const { return _n_events; }
+    bool has(unsigned i) const { return _i_begin <= i and i < _i_begin + _n_events; }
+
+    // emissions of event i, for all states
+    const Float_Type* row(unsigned i) const
+    {
+        assert(has(i));
+        return &_m[static_cast< size_t >(i - _i_begin) * n_states];
+    }
+    Float_Type at(unsigned i, unsigned j) const { return row(i)[j]; }
+
+    // fill the emissions of events [i_begin, i_end) (default: all); returns false,
+    // leaving the matrix empty, if it does not fit max_mb()
+    bool fill(const Pore_Model_Type& pm, const Event_Sequence_Type& ev,
+              unsigned i_begin = 0, unsigned i_end = -1)
+    {
+        i_end = std::min< unsigned >(i_end, ev.size());
+        if (i_end <= i_begin or not fits(i_end - i_begin))
+        {
+            clear();
+            return false;
+        }
+        _i_begin = i_begin;
+        _n_events = i_end - i_begin;
+        // resize without clear, so that the storage of a previous fill is reused
+        _m.resize(static_cast< size_t >(_n_events) * n_states);
+        pm.fill_exact_corrected_emissions(ev.begin() + i_begin, ev.begin() + i_end, &_m[0]);
+        return true;
+    }
+
+private:
+    DP_Arena_Vector< Float_Type > _m;
+    unsigned _i_begin;
+    unsigned _n_events;
+}; // class Emission_Matrix
+
+#endif
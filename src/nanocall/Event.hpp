@@ -2,8 +2,11 @@
 #define __EVENT_HPP
 
 #include <algorithm>
+#include <array>
+#include <cassert>
 #include <cmath>
 #include <iostream>
+#include <string>
 #include <vector>
 
 #include "fast5.hpp"
@@ -15,12 +18,12 @@ class Event
 {
 public:
     Float_Type mean;
+    // drift-corrected mean, only set for output; DP engines correct drift through the scaled model
     Float_Type corrected_mean;
     Float_Type stdv;
     Float_Type start;
     Float_Type length;
     Float_Type log_mean;
-    Float_Type log_corrected_mean;
     Float_Type log_stdv;
     //Float_Type log_start;
     //
@@ -34,8 +37,6 @@ public:
     {
         assert(mean > 0);
         log_mean = std::log(mean);
-        assert(corrected_mean > 0);
-        log_corrected_mean = std::log(corrected_mean);
         if (stdv == 0.0)
         {
             stdv = 0.01;
@@ -74,29 +75,110 @@ struct Event_Sequence
 {
     typedef std::vector< Event< Float_Type, Kmer_Size > > Base;
     using Base::Base;
+    // set corrected_mean, for output
     void apply_drift_correction(Float_Type drift)
     {
         for (auto& e : *this)
         {
-            e.corrected_mean -= drift * e.start;
-            e.log_corrected_mean = std::log(e.corrected_mean);
+            e.corrected_mean = e.mean - drift * e.start;
         }
     }
+    // Merge runs of adjacent events whose levels are statistically indistinguishable.
+    // An event is absorbed into the run before it if the Welch t statistic of their means,
+    // computed on sample counts, is at most max_t. The merged event is the event detection
+    // would have reported for the union of their samples: pooled mean and stdv, summed length.
+    // Emissions of merged events are thus those of a single longer event, and the stays
+    // between the merged events are dropped from the sequence, not scored.
+    // Returns the number of events removed.
+    unsigned merge_events(Float_Type max_t, Float_Type sampling_rate)
+    {
+        Base& v = *this;
+        if (v.size() < 2) return 0;
+        unsigned n_out = 0;
+        // sample count, sum, and sum of squares of the current run
+        double run_n = 0.0;
+        double run_sum = 0.0;
+        double run_sum_sq = 0.0;
+        auto flush = [&] () {
+            auto& e = v[n_out - 1];
+            double m = run_sum / run_n;
+            double var = std::max(run_sum_sq / run_n - m * m, 0.0);
+            e.mean = m;
+            e.corrected_mean = m;
+            e.stdv = std::sqrt(var);
+            e.update_logs();
+        };
+        for (unsigned i = 0; i < v.size(); ++i)
+        {
+            const auto& e = v[i];
+            double n = std::max(double(e.length) * sampling_rate, 1.0);
+            if (n_out > 0)
+            {
+                double m = run_sum / run_n;
+                double var = std::max(run_sum_sq / run_n - m * m, 0.0);
+                double se = std::sqrt(var / run_n + double(e.stdv) * e.stdv / n);
+                if (std::abs(e.mean - m) <= max_t * se)
+                {
+                    v[n_out - 1].length = e.start + e.length - v[n_out - 1].start;
+                    run_n += n;
+                    run_sum += n * e.mean;
+                    run_sum_sq += n * (double(e.stdv) * e.stdv + double(e.mean) * e.mean);
+                    continue;
+                }
+                flush();
+            }
+            if (n_out < i) v[n_out] = e;
+            ++n_out;
+            run_n = n;
+            run_sum = n * e.mean;
+            run_sum_sq = n * (double(e.stdv) * e.stdv + double(e.mean) * e.mean);
+        }
+        flush();
+        unsigned n_removed = v.size() - n_out;
+        v.resize(n_out);
+        return n_removed;
+    }
+    // bases spelled by the state path (model_state_idx and move of every event)
     std::string get_base_seq() const
     {
-        std::string res;
         const Base& v = *this;
-        res.assign(v[0].model_state.begin(), v[0].model_state.end());
+        std::string res;
+        if (v.empty()) return res;
+        size_t n_bases = Kmer_Size;
+        for (unsigned i = 1; i < v.size(); ++i)
+        {
+            n_bases += std::min((unsigned)v[i].move, Kmer_Size);
+        }
+        res.resize(n_bases);
+        char* p = &res[0];
+        p = write_bases(v[0].model_state_idx, Kmer_Size, p);
         for (unsigned i = 1; i < v.size(); ++i)
         {
-            unsigned a = std::min((unsigned)v[i].move, (unsigned)Kmer_Size);
-            unsigned b = Kmer_Size - a;
-            assert(std::string(v[i - 1].model_state.begin() + a, v[i - 1].model_state.end())
-                   == std::string(v[i].model_state.begin(), v[i].model_state.begin() + b));
-            res += std::string(v[i].model_state.begin() + b, v[i].model_state.end());
+            unsigned a = std::min((unsigned)v[i].move, Kmer_Size);
+            assert(a == Kmer_Size
+                   or (v[i - 1].model_state_idx & ((1u << (2 * (Kmer_Size - a))) - 1))
+                   == (v[i].model_state_idx >> (2 * a)));
+            p = write_bases(v[i].model_state_idx, a, p);
         }
         return res;
     }
+    // set the model_state strings from model_state_idx; basecallers only set the latter
+    void fill_model_states()
+    {
+        for (auto& e : *this)
+        {
+            write_bases(e.model_state_idx, Kmer_Size, e.model_state.data());
+        }
+    }
+    // write the last n bases of kmer k to p; returns the end of the output
+    static char* write_bases(unsigned k, unsigned n, char* p)
+    {
+        for (unsigned j = Kmer_Size - n; j < Kmer_Size; ++j)
+        {
+            *p++ = "ACGT"[(k >> (2 * (Kmer_Size - j - 1))) & 0x3];
+        }
+        return p;
+    }
 }; // struct Event_Sequence
 
 #endif
@@ -37,6 +37,8 @@ public:
     std::array< unsigned, 4 > strand_bounds;
     std::array< Float_Type, 2 > time_length;
     unsigned num_ed_events;
+    // strand events before merging
+    std::array< unsigned, 2 > num_unmerged_events;
     Float_Type sampling_rate;
     Float_Type abasic_level;
     bool valid;
@@ -77,9 +79,10 @@ public:
         return _min_ed_events;
     }
 
+    // 0: no limit
     static unsigned& max_ed_events()
     {
-        static unsigned _max_ed_events = 100000;
+        static unsigned _max_ed_events = 0;
         return _max_ed_events;
     }
 
@@ -89,6 +92,13 @@ public:
         return _eventdetection_group;
     }
 
+    // merge adjacent events whose means differ by at most this many standard errors; 0: no merging
+    static double& merge_events_max_t()
+    {
+        static double _merge_events_max_t = 0.0;
+        return _merge_events_max_t;
+    }
+
     // percent of top events to ignore
     static double& abasic_level_top_percent()
     {
@@ -150,6 +160,7 @@ public:
         strand_bounds = {{ 0, 0, 0, 0 }};
         time_length = {{ 0.0, 0.0 }};
         num_ed_events = 0;
+        num_unmerged_events = {{ 0, 0 }};
         abasic_level = 0.0;
         fast5::File f;
         do
@@ -362,6 +373,16 @@ public:
                     events(st).emplace_back(std::move(e));
                 }
             }
+            num_unmerged_events[st] = events(st).size();
+            if (merge_events_max_t() > 0.0)
+            {
+                events(st).merge_events(merge_events_max_t(), sampling_rate);
+                LOG("Fast5_Summary", debug)
+                    << "merge_events read [" << read_id
+                    << "] strand [" << st
+                    << "] events [" << num_unmerged_events[st]
+                    << "] merged [" << events(st).size() << "]" << std::endl;
+            }
         }
         if (must_load_ed_events)
         {
@@ -509,7 +530,7 @@ private:
                 f_p->get_eventdetection_events(eventdetection_group())));
         if (num_ed_events == 0)
         {
-            if (ed_events().size() > max_ed_events())
+            if (max_ed_events() > 0 and ed_events().size() > max_ed_events())
             {
                 LOG("Fast5_Summary", info)
                     << file_name << ": using only " << max_ed_events()
@@ -1,14 +1,21 @@
 #ifndef __FORWARD_BACKWARD_HPP
 #define __FORWARD_BACKWARD_HPP
 
+#include <algorithm>
+#include <array>
+#include <cassert>
 #include <cmath>
 #include <iostream>
 #include <vector>
 #include <set>
+#include <type_traits>
 
 #include "Pore_Model.hpp"
 #include "State_Transitions.hpp"
-#include "logsumset.hpp"
+#include "DP_Arena.hpp"
+#include "Emission_Matrix.hpp"
+#include "Log_Sum_Exp.hpp"
+#include "thread_support.hpp"
 #include "logger.hpp"
 
 template < typename Float_Type, unsigned Kmer_Size = 6 >
@@ -20,7 +27,9 @@ public:
     typedef State_Transitions< Float_Type, Kmer_Size > State_Transitions_Type;
     typedef Event< Float_Type, Kmer_Size > Event_Type;
     typedef Event_Sequence< Float_Type, Kmer_Size > Event_Sequence_Type;
-    typedef logsum::logsumset< Float_Type > LogSumSet_Type;
+    typedef Emission_Matrix< Float_Type, Kmer_Size > Emission_Matrix_Type;
+    typedef Log_Sum_Exp< Float_Type > Log_Sum_Exp_Type;
+    typedef typename State_Transitions_Type::Fixed_Shape_Transitions_Type Fixed_Shape_Transitions_Type;
 
     struct Matrix_Entry
     {
@@ -41,26 +50,324 @@ public:
     Float_Type log_posterior(unsigned i, unsigned j) const { return cell(i, j).alpha + cell(i, j).beta - _log_pr_data; }
     Float_Type log_pr_data() const { return _log_pr_data; }
 
+    // with n_threads() > 1, fill() runs the forward and backward passes of sequences
+    // with at least parallel_min_events() events on 2 threads, if a thread is left idle
+    // by the outer pool (see Spare_Threads); 0 disables this
     static unsigned& n_threads() { static unsigned _n_threads = 1; return _n_threads; }
+    static unsigned& parallel_min_events() { static unsigned _parallel_min_events = 1000; return _parallel_min_events; }
+    static bool parallel_fill(unsigned n_events)
+    {
+        return n_threads() > 1 and parallel_min_events() > 0 and n_events >= parallel_min_events();
+    }
+    // run in linear space with per-column scaling when the transitions are grouped
+    static bool& linear_space() { static bool _linear_space = true; return _linear_space; }
+    // events between forward checkpoints in stream_posteriors(); 0: sqrt(n_events)
+    static unsigned& checkpoint_interval() { static unsigned _checkpoint_interval = 0; return _checkpoint_interval; }
 
+    // if given, em must hold the emissions of pm for all of ev
     void fill(const Pore_Model_Type& pm,
               const State_Transitions_Type& st,
-              const Event_Sequence_Type& ev)
+              const Event_Sequence_Type& ev,
+              const Emission_Matrix_Type* em = nullptr)
     {
         clear();
+        _em = em and not em->empty()? em : nullptr;
+        assert(not _em or (_em->i_begin() == 0 and _em->n_events() == ev.size()));
         unsigned n_events = ev.size();
         _m.resize(n_states * n_events);
+        bool linear = linear_space() and st.fixed_shape().grouped;
+        auto forward = [&] () {
+            if (linear) fill_forward_linear(pm, st, ev, _pass[0]);
+            else fill_forward_log(pm, st, ev, _pass[0]);
+        };
+        auto backward = [&] () {
+            if (linear) fill_backward_linear(pm, st, ev, _pass[1]);
+            else fill_backward_log(pm, st, ev, _pass[1]);
+        };
+        Spare_Threads::Loan loan(parallel_fill(n_events)? 1 : 0);
+        if (loan.size() > 0)
+        {
+            // the passes are independent: they write separate fields of the cells,
+            // and use separate scratch buffers; log_pr_data() is set by the forward pass
+            Thread_Team team(2);
+            team.run([&] (unsigned tid) { if (tid == 0) forward(); else backward(); });
+        }
+        else
+        {
+            forward();
+            backward();
+        }
+    }
+
+    friend std::ostream& operator << (std::ostream& os, const Forward_Backward& fwbw)
+    {
+        for (unsigned i = 0; i < fwbw.n_events(); ++i)
+        {
+            for (unsigned j = 0; j < fwbw.n_states; ++j)
+            {
+                os << i << '\t' << j << '\t'
+                   << fwbw.cell(i, j).alpha << '\t'
+                   << fwbw.cell(i, j).beta << std::endl;
+            }
+        }
+        return os;
+    }
+
+    /*
+     * Posteriors in O(sqrt(n)) columns of memory, without filling the matrix.
+     *
+     * The forward pass keeps only the first (scaled, linear) alpha column of every block of
+     * checkpoint_interval() events. The backward pass recomputes each block from its
+     * checkpoint, last block first, and hands the posteriors of its events to the consumer:
+     * consume(i, p) is called for i = n-1 down to 0, with p[j] = Pr[ S_i = j | E_1 ... E_n ];
+     * p is only valid during the call. log_pr_data() is set; cell() is not available.
+     * Transitions without the grouped fixed shape have no linear recursion: the full matrix
+     * is filled instead, and released after the posteriors are streamed.
+     */
+    template < typename Posterior_Consumer >
+    void stream_posteriors(const Pore_Model_Type& pm,
+                           const State_Transitions_Type& st,
+                           const Event_Sequence_Type& ev,
+                           Posterior_Consumer&& consume,
+                           const Emission_Matrix_Type* em = nullptr)
+    {
+        stream_posteriors_and_transitions(pm, st, ev, consume, No_Transition_Consumer(), em);
+    }
+
+    /*
+     * As stream_posteriors(), also handing the transition posteriors of every event to
+     * consume_transitions, as they are computed by the backward pass: after consume(i, p),
+     * for i < n-1, consume_transitions(i, a, w, inv_z) is called with
+     *   Pr[ S_i = j1, S_{i+1} = j2 | E_1 ... E_n ] = a[j1] * pr(j1 -> j2) * w[j2] * inv_z,
+     * where a is the scaled alpha of event i, and w the scaled emission times beta of
+     * event i+1. The arrays are only valid during the call.
+     */
+    template < typename Posterior_Consumer, typename Transition_Consumer >
+    void stream_posteriors_and_transitions(const Pore_Model_Type& pm,
+                                           const State_Transitions_Type& st,
+                                           const Event_Sequence_Type& ev,
+                                           Posterior_Consumer&& consume,
+                                           Transition_Consumer&& consume_transitions,
+                                           const Emission_Matrix_Type* em = nullptr)
+    {
+        unsigned n_events = ev.size();
+        _posterior.resize(n_states);
+        if (not st.fixed_shape().grouped)
+        {
+            fill(pm, st, ev, em);
+            stream_posteriors_and_transitions(pm, ev, consume, consume_transitions);
+            clear();
+            return;
+        }
+        Float_Type* p = &_posterior[0];
+        clear();
+        _em = em and not em->empty()? em : nullptr;
+        assert(not _em or (_em->i_begin() == 0 and _em->n_events() == ev.size()));
+        unsigned k = checkpoint_interval() > 0
+            ? checkpoint_interval()
+            : std::max(static_cast< unsigned >(std::ceil(std::sqrt(static_cast< double >(n_events)))), 1u);
+        unsigned n_blocks = (n_events + k - 1) / k;
+        _checkpoint.resize(static_cast< size_t >(n_blocks) * n_states);
+        _block.resize(static_cast< size_t >(std::min(k, n_events)) * n_states);
+        Pass_Buffers& buf = _pass[0];
+        buf.prev.resize(n_states);
+        buf.crt.resize(n_states);
+        buf.column.resize(n_states);
+        //
+        // forward, keeping the first column of every block
+        //
+        Float_Type log_scale = -std::log(static_cast< Float_Type >(n_states));
+        const Float_Type* a_prev = nullptr;
+        for (unsigned i = 0; i < n_events; ++i)
+        {
+            Float_Type* a = (i % k == 0
+                             ? &_checkpoint[static_cast< size_t >(i / k) * n_states]
+                             : (i % 2 == 0? &buf.prev[0] : &buf.crt[0]));
+            if (i == 0)
+            {
+                std::fill(a, a + n_states, Float_Type(1));
+            }
+            else
+            {
+                forward_transitions_linear(st, a_prev, a, buf);
+            }
+            log_scale += scale_column_linear(emission_row(pm, ev, i, buf), a, a);
+            a_prev = a;
+        }
+        _log_pr_data = log_scale;
+        //
+        // backward, recomputing the alpha columns of one block at a time
+        //
+        Float_Type* b_next = &buf.prev[0];
+        Float_Type* b = &buf.crt[0];
+        Float_Type* w = &buf.column[0];
+        for (unsigned blk = n_blocks; blk > 0; --blk)
+        {
+            unsigned i_begin = (blk - 1) * k;
+            unsigned i_end = std::min(i_begin + k, n_events);
+            LOG("Forward_Backward", debug1) << "stream_posteriors: block i_begin=" << i_begin << std::endl;
+            auto block_col = [&] (unsigned i) { return &_block[static_cast< size_t >(i - i_begin) * n_states]; };
+            std::copy_n(&_checkpoint[static_cast< size_t >(blk - 1) * n_states], n_states, block_col(i_begin));
+            for (unsigned i = i_begin + 1; i < i_end; ++i)
+            {
+                forward_transitions_linear(st, block_col(i - 1), block_col(i), buf);
+                scale_column_linear(emission_row(pm, ev, i, buf), block_col(i), block_col(i));
+            }
+            for (unsigned ip1 = i_end; ip1 > i_begin; --ip1)
+            {
+                unsigned i = ip1 - 1;
+                // log of \sum_j a[j] (unnormalized b[j])
+                Float_Type log_z = 0;
+                if (ip1 == n_events)
+                {
+                    std::fill(b, b + n_states, Float_Type(1));
+                }
+                else
+                {
+                    scale_column_linear(emission_row(pm, ev, ip1, buf), b_next, w, false);
+                    backward_transitions_linear(st, w, b, buf);
+                    log_z += normalize_column_linear(b);
+                }
+                const Float_Type* a = block_col(i);
+                for (unsigned j = 0; j < n_states; ++j)
+                {
+                    p[j] = a[j] * b[j];
+                }
+                log_z += normalize_column_linear(p);
+                consume(i, static_cast< const Float_Type* >(p));
+                if (ip1 < n_events)
+                {
+                    consume_transitions(i, a, static_cast< const Float_Type* >(w), std::exp(-log_z));
+                }
+                std::swap(b, b_next);
+            }
+        }
+        _checkpoint.clear();
+        _block.clear();
+    }
+
+    // after fill(): hand the posteriors of the matrix to consume, as above
+    template < typename Posterior_Consumer >
+    void stream_posteriors(Posterior_Consumer&& consume)
+    {
+        _posterior.resize(n_states);
+        Float_Type* p = &_posterior[0];
+        for (unsigned ip1 = n_events(); ip1 > 0; --ip1)
+        {
+            unsigned i = ip1 - 1;
+            for (unsigned j = 0; j < n_states; ++j)
+            {
+                p[j] = std::exp(log_posterior(i, j));
+            }
+            consume(i, static_cast< const Float_Type* >(p));
+        }
+    }
+
+    // after fill(pm, st, ev): hand the posteriors and the transition posteriors of
+    // the matrix to the consumers, as in stream_posteriors_and_transitions()
+    template < typename Posterior_Consumer, typename Transition_Consumer >
+    void stream_posteriors_and_transitions(const Pore_Model_Type& pm,
+                                           const Event_Sequence_Type& ev,
+                                           Posterior_Consumer&& consume,
+                                           Transition_Consumer&& consume_transitions)
+    {
+        if (std::is_same< typename std::decay< Transition_Consumer >::type, No_Transition_Consumer >::value)
+        {
+            stream_posteriors(consume);
+            return;
+        }
+        _posterior.resize(n_states);
+        Pass_Buffers& buf = _pass[0];
+        buf.crt.resize(n_states);
+        buf.column.resize(n_states);
+        Float_Type* p = &_posterior[0];
+        Float_Type* a = &buf.crt[0];
+        Float_Type* w = &buf.column[0];
+        for (unsigned ip1 = n_events(); ip1 > 0; --ip1)
+        {
+            unsigned i = ip1 - 1;
+            for (unsigned j = 0; j < n_states; ++j)
+            {
+                p[j] = std::exp(log_posterior(i, j));
+            }
+            consume(i, static_cast< const Float_Type* >(p));
+            if (ip1 == n_events()) continue;
+            // shift alpha and emission times beta by their maxima before exponentiation
+            const Float_Type* em_row = emission_row(pm, ev, ip1, buf);
+            Float_Type ma = -INFINITY;
+            Float_Type mw = -INFINITY;
+            for (unsigned j = 0; j < n_states; ++j)
+            {
+                a[j] = cell(i, j).alpha;
+                w[j] = em_row[j] + cell(ip1, j).beta;
+                ma = std::max(ma, a[j]);
+                mw = std::max(mw, w[j]);
+            }
+            for (unsigned j = 0; j < n_states; ++j)
+            {
+                a[j] = std::exp(a[j] - ma);
+                w[j] = std::exp(w[j] - mw);
+            }
+            consume_transitions(i, static_cast< const Float_Type* >(a), static_cast< const Float_Type* >(w),
+                                std::exp(ma + mw - _log_pr_data));
+        }
+    }
+
+private:
+    struct No_Transition_Consumer
+    {
+        void operator () (unsigned, const Float_Type*, const Float_Type*, Float_Type) const {}
+    }; // struct No_Transition_Consumer
+
+    // scratch of one DP pass; fill() gives its forward and backward passes separate buffers
+    struct Pass_Buffers
+    {
+        // linear-space columns: scaled alpha/beta of the previous and current event
+        std::vector< Float_Type > prev;
+        std::vector< Float_Type > crt;
+        std::vector< Float_Type > group_sum;
+        std::vector< Float_Type > column;
+        std::vector< Float_Type > emission;
+    }; // struct Pass_Buffers
+
+    DP_Arena_Vector< Matrix_Entry > _m;
+    std::array< Pass_Buffers, 2 > _pass;
+    // stream_posteriors(): forward checkpoints, alpha columns of the current block, posteriors
+    DP_Arena_Vector< Float_Type > _checkpoint;
+    DP_Arena_Vector< Float_Type > _block;
+    std::vector< Float_Type > _posterior;
+    Float_Type _log_pr_data;
+    // emissions of the current fill, if precomputed
+    const Emission_Matrix_Type* _em = nullptr;
+
+    // emissions of event i, for all states
+    const Float_Type* emission_row(const Pore_Model_Type& pm, const Event_Sequence_Type& ev, unsigned i,
+                                   Pass_Buffers& buf)
+    {
+        if (_em) return _em->row(i);
+        buf.emission.resize(n_states);
+        pm.fill_exact_corrected_emissions(ev[i], &buf.emission[0]);
+        return &buf.emission[0];
+    }
+
+    // log-space forward pass; sets log_pr_data()
+    void fill_forward_log(const Pore_Model_Type& pm,
+                          const State_Transitions_Type& st,
+                          const Event_Sequence_Type& ev,
+                          Pass_Buffers& buf)
+    {
+        Log_Sum_Exp_Type s;
         Float_Type log_n_states = std::log(static_cast< Float_Type >(n_states));
-        LogSumSet_Type s(false);
         //
         // forward: alpha, i == 0
         //
         {
             unsigned i = 0;
             LOG("Forward_Backward", debug1) << "forward: i=" << i << std::endl;
+            const Float_Type* em_row = emission_row(pm, ev, i, buf);
             for (unsigned j = 0; j < n_states; ++j)
             {
-                cell(i, j).alpha = pm.log_pr_corrected_emission(j, ev[0]) - log_n_states;
+                cell(i, j).alpha = em_row[j] - log_n_states;
                 LOG("Forward_Backward", debug2)
                     << "i=" << i << " j=" << j << " kmer_j=" << Kmer_Type::to_string(j)
                     << " alpha=" << cell(i, j).alpha << std::endl;
@@ -72,6 +379,12 @@ public:
         for (unsigned i = 1; i < ev.size(); ++i)
         {
             LOG("Forward_Backward", debug1) << "forward: i=" << i << std::endl;
+            if (st.fixed_shape().grouped)
+            {
+                fill_forward_column_grouped(pm, st, ev, i, buf);
+                continue;
+            }
+            const Float_Type* em_row = emission_row(pm, ev, i, buf);
             for (unsigned j = 0; j < n_states; ++j)
             {
                 s.clear();
@@ -81,13 +394,31 @@ public:
                     const Float_Type& log_pr_transition = p.second;
                     s.add(log_pr_transition + cell(i - 1, j_prev).alpha);
                 }
-                cell(i, j).alpha = pm.log_pr_corrected_emission(j, ev[i]) + s.val();
+                cell(i, j).alpha = em_row[j] + s.val();
                 LOG("Forward_Backward", debug2)
                     << "i=" << i << " j=" << j << " kmer_j=" << Kmer_Type::to_string(j)
                     << " alpha=" << cell(i, j).alpha << std::endl;
             }
         }
         //
+        // pr_data
+        //
+        s.clear();
+        for (unsigned j = 0; j < n_states; ++j)
+        {
+            s.add(cell(ev.size() - 1, j).alpha);
+        }
+        _log_pr_data = s.val();
+    }
+
+    // log-space backward pass
+    void fill_backward_log(const Pore_Model_Type& pm,
+                           const State_Transitions_Type& st,
+                           const Event_Sequence_Type& ev,
+                           Pass_Buffers& buf)
+    {
+        Log_Sum_Exp_Type s;
+        //
         // backward: beta, i == n-1
         //
         {
@@ -108,6 +439,12 @@ public:
         {
             unsigned i = ip1 - 1;
             LOG("Forward_Backward", debug1) << "backward: i=" << i << std::endl;
+            if (st.fixed_shape().grouped)
+            {
+                fill_backward_column_grouped(pm, st, ev, i, buf);
+                continue;
+            }
+            const Float_Type* em_row = emission_row(pm, ev, ip1, buf);
             for (unsigned j = 0; j < n_states; ++j)
             {
                 s.clear();
@@ -115,7 +452,7 @@ public:
                 {
                     const unsigned& j_next = p.first;
                     const Float_Type& log_pr_transition = p.second;
-                    s.add(log_pr_transition + pm.log_pr_corrected_emission(j_next, ev[ip1]) + cell(ip1, j_next).beta);
+                    s.add(log_pr_transition + em_row[j_next] + cell(ip1, j_next).beta);
                 }
                 cell(i, j).beta += s.val();
                 LOG("Forward_Backward", debug2)
@@ -123,34 +460,326 @@ public:
                     << " beta=" << cell(i, j).beta << std::endl;
             }
         }
-        //
-        // pr_data
-        //
-        s.clear();
+    }
+
+    /*
+     * Linear-space forward-backward.
+     *
+     * Column i of alpha (resp. beta) is kept as probabilities normalized to sum 1, times
+     * the log scale of the column, so the recursion is multiply-add over the grouped
+     * transitions. Before exponentiation, each column is shifted by the maximum over states
+     * of the log emission plus the log of the incoming mass, so its largest term is 1; terms
+     * falling out of the Float_Type range relative to that one are dropped, and their cells
+     * get -INFINITY. The cells hold
+     * log(alpha) and log(beta) as in log space, and log_pr_data() is the sum of the
+     * forward log scales.
+     */
+    void fill_forward_linear(const Pore_Model_Type& pm,
+                             const State_Transitions_Type& st,
+                             const Event_Sequence_Type& ev,
+                             Pass_Buffers& buf)
+    {
+        unsigned n_events = ev.size();
+        buf.prev.resize(n_states);
+        buf.crt.resize(n_states);
+        Float_Type log_scale = -std::log(static_cast< Float_Type >(n_states));
+        for (unsigned i = 0; i < n_events; ++i)
+        {
+            LOG("Forward_Backward", debug1) << "forward: i=" << i << std::endl;
+            Float_Type* a = &buf.crt[0];
+            if (i == 0)
+            {
+                std::fill(a, a + n_states, Float_Type(1));
+            }
+            else
+            {
+                forward_transitions_linear(st, &buf.prev[0], a, buf);
+            }
+            log_scale += scale_column_linear(emission_row(pm, ev, i, buf), a, a);
+            for (unsigned j = 0; j < n_states; ++j)
+            {
+                cell(i, j).alpha = std::log(a[j]) + log_scale;
+                LOG("Forward_Backward", debug2)
+                    << "i=" << i << " j=" << j << " kmer_j=" << Kmer_Type::to_string(j)
+                    << " alpha=" << cell(i, j).alpha << std::endl;
+            }
+            std::swap(buf.prev, buf.crt);
+        }
+        _log_pr_data = log_scale;
+    }
+
+    void fill_backward_linear(const Pore_Model_Type& pm,
+                              const State_Transitions_Type& st,
+                              const Event_Sequence_Type& ev,
+                              Pass_Buffers& buf)
+    {
+        unsigned n_events = ev.size();
+        buf.prev.resize(n_states);
+        buf.crt.resize(n_states);
+        Float_Type log_scale = 0;
+        std::fill(buf.prev.begin(), buf.prev.end(), Float_Type(1));
         for (unsigned j = 0; j < n_states; ++j)
         {
-            s.add(cell(ev.size() - 1, j).alpha);
+            cell(n_events - 1, j).beta = 0;
+        }
+        for (unsigned ip1 = n_events - 1; ip1 > 0; --ip1)
+        {
+            unsigned i = ip1 - 1;
+            LOG("Forward_Backward", debug1) << "backward: i=" << i << std::endl;
+            // buf.prev: emission times beta of event i+1
+            log_scale += scale_column_linear(emission_row(pm, ev, ip1, buf), &buf.prev[0], &buf.prev[0], false);
+            Float_Type* b = &buf.crt[0];
+            backward_transitions_linear(st, &buf.prev[0], b, buf);
+            log_scale += normalize_column_linear(b);
+            for (unsigned j = 0; j < n_states; ++j)
+            {
+                cell(i, j).beta = std::log(b[j]) + log_scale;
+                LOG("Forward_Backward", debug2)
+                    << "i=" << i << " j=" << j << " kmer_j=" << Kmer_Type::to_string(j)
+                    << " beta=" << cell(i, j).beta << std::endl;
+            }
+            std::swap(buf.prev, buf.crt);
         }
-        _log_pr_data = s.val();
     }
 
-    friend std::ostream& operator << (std::ostream& os, const Forward_Backward& fwbw)
+    // out[j] := exp(em_row[j] + log(in[j]) - m), where m is the maximum of em_row[j] + log(in[j]),
+    // so the largest term is 1; if normalize, out is also divided by its sum; returns the log scale removed
+    static Float_Type scale_column_linear(const Float_Type* em_row, const Float_Type* in, Float_Type* out,
+                                          bool normalize = true)
     {
-        for (unsigned i = 0; i < fwbw.n_events(); ++i)
+        Float_Type m = -INFINITY;
+        for (unsigned j = 0; j < n_states; ++j)
         {
-            for (unsigned j = 0; j < fwbw.n_states; ++j)
+            out[j] = in[j] > 0? em_row[j] + std::log(in[j]) : -INFINITY;
+            if (out[j] > m) m = out[j];
+        }
+        for (unsigned j = 0; j < n_states; ++j)
+        {
+            out[j] = m > -INFINITY? std::exp(out[j] - m) : Float_Type(0);
+        }
+        if (m == -INFINITY) return m;
+        return normalize? m + normalize_column_linear(out) : m;
+    }
+
+    // divide a column by its sum; returns the log of the sum
+    static Float_Type normalize_column_linear(Float_Type* col)
+    {
+        Float_Type c = 0;
+        for (unsigned j = 0; j < n_states; ++j)
+        {
+            c += col[j];
+        }
+        if (c > 0)
+        {
+            Float_Type inv_c = 1 / c;
+            for (unsigned j = 0; j < n_states; ++j)
             {
-                os << i << '\t' << j << '\t'
-                   << fwbw.cell(i, j).alpha << '\t'
-                   << fwbw.cell(i, j).beta << std::endl;
+                col[j] *= inv_c;
             }
         }
-        return os;
+        return std::log(c);
     }
 
-private:
-    std::vector< Matrix_Entry > _m;
-    Float_Type _log_pr_data;
+    // a[j] := \sum_k pr(k -> j) a_prev[k], with the grouped recursion of fill_forward_column_grouped()
+    static void forward_transitions_linear(const State_Transitions_Type& st, const Float_Type* a_prev, Float_Type* a,
+                                           Pass_Buffers& buf)
+    {
+        static const unsigned n_step_groups = Fixed_Shape_Transitions_Type::n_step_groups;
+        static const unsigned n_skip_groups = Fixed_Shape_Transitions_Type::n_skip_groups;
+        const Fixed_Shape_Transitions_Type& fst = st.fixed_shape();
+        buf.group_sum.resize(n_step_groups + n_skip_groups);
+        Float_Type* step_s = &buf.group_sum[0];
+        Float_Type* skip_s = &buf.group_sum[n_step_groups];
+        for (unsigned q = 0; q < n_step_groups; ++q)
+        {
+            step_s[q] = a_prev[q] + a_prev[n_step_groups + q]
+                + a_prev[2 * n_step_groups + q] + a_prev[3 * n_step_groups + q];
+        }
+        for (unsigned r = 0; r < n_skip_groups; ++r)
+        {
+            skip_s[r] = step_s[r] + step_s[n_skip_groups + r]
+                + step_s[2 * n_skip_groups + r] + step_s[3 * n_skip_groups + r];
+        }
+        const Float_Type* pr_stay = fst.pr_group_slice(0);
+        const Float_Type* pr_step = fst.pr_group_slice(1);
+        const Float_Type* pr_skip = fst.pr_group_slice(2);
+        for (unsigned j = 0; j < n_states; ++j)
+        {
+            a[j] = pr_stay[j] * a_prev[j] + pr_step[j] * step_s[j >> 2]
+                + pr_skip[j] * skip_s[j >> 4];
+        }
+        for (unsigned k = 0; k < fst.irregular_v.size(); ++k)
+        {
+            Float_Type v = 0;
+            for (auto it = fst.irregular_from_begin(k); it != fst.irregular_from_end(k); ++it)
+            {
+                v += it->second * a_prev[it->first];
+            }
+            a[fst.irregular_v[k]] = v;
+        }
+    }
+
+    // b[j] := \sum_k pr(j -> k) w[k], with the grouped recursion of fill_backward_column_grouped()
+    static void backward_transitions_linear(const State_Transitions_Type& st, const Float_Type* w, Float_Type* b,
+                                            Pass_Buffers& buf)
+    {
+        static const unsigned n_step_groups = Fixed_Shape_Transitions_Type::n_step_groups;
+        static const unsigned n_skip_groups = Fixed_Shape_Transitions_Type::n_skip_groups;
+        const Fixed_Shape_Transitions_Type& fst = st.fixed_shape();
+        buf.group_sum.resize(n_step_groups + n_skip_groups);
+        Float_Type* step_s = &buf.group_sum[0];
+        Float_Type* skip_s = &buf.group_sum[n_step_groups];
+        const Float_Type* pr_stay = fst.pr_group_slice(0);
+        const Float_Type* pr_step = fst.pr_group_slice(1);
+        const Float_Type* pr_skip = fst.pr_group_slice(2);
+        for (unsigned q = 0; q < n_step_groups; ++q)
+        {
+            const unsigned k = q << 2;
+            step_s[q] = pr_step[k] * w[k] + pr_step[k + 1] * w[k + 1]
+                + pr_step[k + 2] * w[k + 2] + pr_step[k + 3] * w[k + 3];
+        }
+        for (unsigned r = 0; r < n_skip_groups; ++r)
+        {
+            Float_Type v = 0;
+            for (unsigned k = r << 4; k < (r + 1) << 4; ++k)
+            {
+                v += pr_skip[k] * w[k];
+            }
+            skip_s[r] = v;
+        }
+        for (unsigned j = 0; j < n_states; ++j)
+        {
+            b[j] = pr_stay[j] * w[j] + step_s[j % n_step_groups] + skip_s[j % n_skip_groups];
+            for (unsigned k = fst.irregular_to_start(j); k < fst.irregular_to_start(j + 1); ++k)
+            {
+                b[j] += fst.irregular_to_pr(k) * w[fst.irregular_to_v[k].first];
+            }
+        }
+    }
+
+    // forward column i using the grouped recursion: the sum over the step (resp. skip)
+    // predecessors is computed once per group, and shared by the 4 (resp. 16) regular
+    // states using it; irregular states use their predecessor lists; all sums go through
+    // Log_Sum_Exp, so each takes a single log
+    void fill_forward_column_grouped(const Pore_Model_Type& pm,
+                                     const State_Transitions_Type& st,
+                                     const Event_Sequence_Type& ev,
+                                     unsigned i,
+                                     Pass_Buffers& buf)
+    {
+        static const unsigned n_step_groups = Fixed_Shape_Transitions_Type::n_step_groups;
+        static const unsigned n_skip_groups = Fixed_Shape_Transitions_Type::n_skip_groups;
+        const Fixed_Shape_Transitions_Type& fst = st.fixed_shape();
+        buf.group_sum.resize(n_step_groups + n_skip_groups);
+        Float_Type* step_s = &buf.group_sum[0];
+        Float_Type* skip_s = &buf.group_sum[n_step_groups];
+        Float_Type t[4];
+        // step group q: states b * 4^(Kmer_Size-1) + q
+        for (unsigned q = 0; q < n_step_groups; ++q)
+        {
+            for (unsigned b = 0; b < 4; ++b)
+            {
+                t[b] = cell(i - 1, b * n_step_groups + q).alpha;
+            }
+            step_s[q] = Log_Sum_Exp_Type::log_sum_exp(t, 4);
+        }
+        // skip group r: step groups b * 4^(Kmer_Size-2) + r
+        for (unsigned r = 0; r < n_skip_groups; ++r)
+        {
+            for (unsigned b = 0; b < 4; ++b)
+            {
+                t[b] = step_s[b * n_skip_groups + r];
+            }
+            skip_s[r] = Log_Sum_Exp_Type::log_sum_exp(t, 4);
+        }
+        const Float_Type* em_row = emission_row(pm, ev, i, buf);
+        Log_Sum_Exp_Type s;
+        for (unsigned j = 0; j < n_states; ++j)
+        {
+            Float_Type v;
+            if (fst.is_regular(j))
+            {
+                t[0] = fst.log_pr_group(0, j) + cell(i - 1, j).alpha;
+                t[1] = fst.log_pr_group(1, j) + step_s[j >> 2];
+                t[2] = fst.log_pr_group(2, j) + skip_s[j >> 4];
+                v = Log_Sum_Exp_Type::log_sum_exp(t, 3);
+            }
+            else
+            {
+                s.clear();
+                for (const auto& p : st.neighbours(j).from_v)
+                {
+                    s.add(p.second + cell(i - 1, p.first).alpha);
+                }
+                v = s.val();
+            }
+            cell(i, j).alpha = em_row[j] + v;
+            LOG("Forward_Backward", debug2)
+                << "i=" << i << " j=" << j << " kmer_j=" << Kmer_Type::to_string(j)
+                << " alpha=" << cell(i, j).alpha << std::endl;
+        }
+    }
+
+    // backward column i: transitions into regular states are summed once per group of
+    // successors (the 4 states with the same (Kmer_Size-1)-prefix, resp. the 16 states with
+    // the same (Kmer_Size-2)-prefix); transitions into irregular states are added explicitly
+    void fill_backward_column_grouped(const Pore_Model_Type& pm,
+                                      const State_Transitions_Type& st,
+                                      const Event_Sequence_Type& ev,
+                                      unsigned i,
+                                      Pass_Buffers& buf)
+    {
+        static const unsigned n_step_groups = Fixed_Shape_Transitions_Type::n_step_groups;
+        static const unsigned n_skip_groups = Fixed_Shape_Transitions_Type::n_skip_groups;
+        const Fixed_Shape_Transitions_Type& fst = st.fixed_shape();
+        unsigned ip1 = i + 1;
+        buf.column.resize(n_states);
+        buf.group_sum.resize(n_step_groups + n_skip_groups);
+        Float_Type* step_s = &buf.group_sum[0];
+        Float_Type* skip_s = &buf.group_sum[n_step_groups];
+        // emission and beta of the next event, computed once per state
+        const Float_Type* em_row = emission_row(pm, ev, ip1, buf);
+        for (unsigned k = 0; k < n_states; ++k)
+        {
+            buf.column[k] = em_row[k] + cell(ip1, k).beta;
+        }
+        Float_Type t[16];
+        // step group q: regular successors (q << 2) + b
+        for (unsigned q = 0; q < n_step_groups; ++q)
+        {
+            for (unsigned k = q << 2; k < (q + 1) << 2; ++k)
+            {
+                t[k - (q << 2)] = fst.log_pr_group(1, k) + buf.column[k];
+            }
+            step_s[q] = Log_Sum_Exp_Type::log_sum_exp(t, 4);
+        }
+        // skip group r: regular successors (r << 4) + c
+        for (unsigned r = 0; r < n_skip_groups; ++r)
+        {
+            for (unsigned k = r << 4; k < (r + 1) << 4; ++k)
+            {
+                t[k - (r << 4)] = fst.log_pr_group(2, k) + buf.column[k];
+            }
+            skip_s[r] = Log_Sum_Exp_Type::log_sum_exp(t, 16);
+        }
+        Log_Sum_Exp_Type s;
+        for (unsigned j = 0; j < n_states; ++j)
+        {
+            s.clear();
+            s.add(fst.log_pr_group(0, j) + buf.column[j]);
+            s.add(step_s[j % n_step_groups]);
+            s.add(skip_s[j % n_skip_groups]);
+            for (auto it = fst.irregular_to_begin(j); it != fst.irregular_to_end(j); ++it)
+            {
+                s.add(it->second + buf.column[it->first]);
+            }
+            Float_Type v = s.val();
+            cell(i, j).beta += v;
+            LOG("Forward_Backward", debug2)
+                << "i=" << i << " j=" << j << " kmer_j=" << Kmer_Type::to_string(j)
+                << " beta=" << cell(i, j).beta << std::endl;
+        }
+    }
 }; // class Forward_Backward
 
 #endif
@@ -8,7 +8,8 @@
 
 #include "Pore_Model.hpp"
 #include "State_Transitions.hpp"
-#include "logsumset.hpp"
+#include "DP_Arena.hpp"
+#include "Log_Sum_Exp.hpp"
 #include "logger.hpp"
 
 template < typename Float_Type, unsigned Kmer_Size = 6 >
@@ -20,7 +21,7 @@ public:
     typedef State_Transitions< Float_Type, Kmer_Size > State_Transitions_Type;
     typedef Event< Float_Type, Kmer_Size > Event_Type;
     typedef Event_Sequence< Float_Type, Kmer_Size > Event_Sequence_Type;
-    typedef logsum::logsumset< Float_Type > LogSumSet_Type;
+    typedef Log_Sum_Exp< Float_Type > Log_Sum_Exp_Type;
 
     struct Matrix_Entry
     {
@@ -51,8 +52,8 @@ public:
         unsigned n_events = ev.size();
         _m.resize(n_states * n_events);
         Float_Type log_n_states = std::log(static_cast< Float_Type >(n_states));
-        LogSumSet_Type s1(false);
-        LogSumSet_Type s2(false);
+        Log_Sum_Exp_Type s1;
+        Log_Sum_Exp_Type s2;
         //
         // forward: alpha, beta; i == 0
         //
@@ -157,7 +158,7 @@ public:
     }
 
 private:
-    std::vector< Matrix_Entry > _m;
+    DP_Arena_Vector< Matrix_Entry > _m;
 }; // class Forward_Backward_Custom
 
 #endif
@@ -0,0 +1,162 @@
+#ifndef __LOG_SUM_EXP_HPP
+#define __LOG_SUM_EXP_HPP
+
+#include <algorithm>
+#include <array>
+#include <cassert>
+#include <cmath>
+
+#include "simd_support.hpp"
+
+/*
+ * Streaming log-sum-exp, with the clear()/add()/val() interface of logsum::logsumset.
+ *
+ * Values are buffered, and every buffer_size values the buffer is reduced with simd::Vec:
+ * its maximum m is found, and exp(v - m) is summed. The running result is kept as
+ * (max, sum), and the sum is rescaled when the max grows; val() reduces the buffer
+ * without consuming it.
+ *
+ * exp_degree() selects the exponential used by the reduction: 0 is std::exp; d in [2, 7]
+ * is fast_exp(), which evaluates 2^f, f in [-1/2, 1/2], with the degree-d Taylor polynomial
+ * of exp(f ln2). Its relative error is about (ln2/2)^(d+1)/(d+1)!: 6e-4 for d = 3,
+ * 2.4e-6 for d = 5, 1.2e-7 (float precision) for d = 6. Other degrees are rejected by
+ * valid_exp_degree(). Terms below 2^-126 of the maximum are counted as 2^-126.
+ */
+template < typename Float_Type >
+class Log_Sum_Exp
+{
+public:
+    typedef simd::Vec< Float_Type > Vec_Type;
+    typedef simd::Scalar_Vec< Float_Type > Scalar_Vec_Type;
+
+    static const unsigned buffer_size = 64;
+    static const unsigned max_exp_degree = 7;
+
+    static unsigned& exp_degree() { static unsigned _exp_degree = 6; return _exp_degree; }
+    static bool valid_exp_degree(unsigned d) { return d == 0 or (d >= 2 and d <= max_exp_degree); }
+
+    Log_Sum_Exp() { clear(); }
+
+    void clear()
+    {
+        _n = 0;
+        _max = -INFINITY;
+        _sum = 0;
+    }
+    void add(Float_Type v)
+    {
+        _buf[_n++] = v;
+        if (_n == buffer_size)
+        {
+            reduce(_buf.data(), _n, _max, _sum);
+            _n = 0;
+        }
+    }
+    Float_Type val() const
+    {
+        Float_Type m = _max;
+        Float_Type s = _sum;
+        reduce(_buf.data(), _n, m, s);
+        return m == -INFINITY? m : m + std::log(s);
+    }
+
+    // log \sum_k exp(p[k])
+    static Float_Type log_sum_exp(const Float_Type* p, unsigned n)
+    {
+        Float_Type m = -INFINITY;
+        Float_Type s = 0;
+        reduce(p, n, m, s);
+        return m == -INFINITY? m : m + std::log(s);
+    }
+
+    // exp(x), for x <= 0, with a polynomial of the given degree
+    template < typename V >
+    static typename V::type fast_exp(typename V::type x, unsigned degree)
+    {
+        const Float_Type log2e = 1.4426950408889634074;
+        const Float_Type ln2 = 0.69314718055994530942;
+        // 1/k!
+        const Float_Type c[max_exp_degree + 1] = {
+            1.0, 1.0, 1.0 / 2, 1.0 / 6, 1.0 / 24, 1.0 / 120, 1.0 / 720, 1.0 / 5040 };
+        auto t = V::max(V::mul(x, V::set1(log2e)), V::set1(-126));
+        auto n = V::round(t);
+        auto y = V::mul(V::sub(t, n), V::set1(ln2));
+        auto r = V::set1(c[degree]);
+        for (unsigned k = degree; k > 0; --k)
+        {
+            r = V::add(V::mul(r, y), V::set1(c[k - 1]));
+        }
+        return V::mul(r, V::pow2i(n));
+    }
+
+private:
+    std::array< Float_Type, buffer_size > _buf;
+    unsigned _n;
+    Float_Type _max;
+    Float_Type _sum;
+
+    // fold p[0, n) into the running (m, s)
+    static void reduce(const Float_Type* p, unsigned n, Float_Type& m, Float_Type& s)
+    {
+        if (n == 0) return;
+        unsigned n_vec = n / Vec_Type::width * Vec_Type::width;
+        // max
+        Float_Type new_m = m;
+        if (n_vec > 0)
+        {
+            auto v = Vec_Type::load(p);
+            for (unsigned k = Vec_Type::width; k < n_vec; k += Vec_Type::width)
+            {
+                v = Vec_Type::max(v, Vec_Type::load(p + k));
+            }
+            Float_Type a[Vec_Type::width];
+            Vec_Type::store(a, v);
+            new_m = std::max(new_m, *std::max_element(a, a + Vec_Type::width));
+        }
+        for (unsigned k = n_vec; k < n; ++k)
+        {
+            new_m = std::max(new_m, p[k]);
+        }
+        if (new_m == -INFINITY) return;
+        if (new_m == INFINITY)
+        {
+            m = new_m;
+            s = 1;
+            return;
+        }
+        // sum
+        if (m > -INFINITY and m < new_m)
+        {
+            s *= std::exp(m - new_m);
+        }
+        m = new_m;
+        unsigned degree = exp_degree();
+        assert(valid_exp_degree(degree));
+        if (degree == 0)
+        {
+            for (unsigned k = 0; k < n; ++k)
+            {
+                s += std::exp(p[k] - m);
+            }
+            return;
+        }
+        auto mv = Vec_Type::set1(m);
+        auto sv = Vec_Type::set1(0);
+        for (unsigned k = 0; k < n_vec; k += Vec_Type::width)
+        {
+            sv = Vec_Type::add(sv, fast_exp< Vec_Type >(Vec_Type::sub(Vec_Type::load(p + k), mv), degree));
+        }
+        Float_Type a[Vec_Type::width];
+        Vec_Type::store(a, sv);
+        for (unsigned l = 0; l < Vec_Type::width; ++l)
+        {
+            s += a[l];
+        }
+        for (unsigned k = n_vec; k < n; ++k)
+        {
+            s += fast_exp< Scalar_Vec_Type >(p[k] - m, degree);
+        }
+    }
+}; // class Log_Sum_Exp
+
+#endif
@@ -0,0 +1,236 @@
+#ifndef __ONLINE_VITERBI_HPP
+#define __ONLINE_VITERBI_HPP
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <string>
+#include <vector>
+
+#include "Pore_Model.hpp"
+#include "State_Transitions.hpp"
+#include "DP_Arena.hpp"
+#include "Viterbi.hpp"
+#include "logger.hpp"
+
+/*
+ * Viterbi decoder consuming events one at a time.
+ *
+ * Every state of the current column carries the label of its ancestor at an anchor column.
+ * When all states share the same label, every surviving path goes through that ancestor,
+ * so the path up to the anchor is final: it is committed, the traceback rows behind it are
+ * released, and the current column becomes the new anchor. If paths do not merge within
+ * the lag (max_lag() unless given to the constructor), the prefix is committed along the
+ * current best path, and later paths are constrained to go through it. Memory is bounded
+ * by the lag, not the sequence length.
+ */
+template < typename Float_Type, unsigned Kmer_Size = 6 >
+class Online_Viterbi
+{
+public:
+    typedef Kmer< Kmer_Size > Kmer_Type;
+    typedef Pore_Model< Float_Type, Kmer_Size > Pore_Model_Type;
+    typedef State_Transitions< Float_Type, Kmer_Size > State_Transitions_Type;
+    typedef Event< Float_Type, Kmer_Size > Event_Type;
+    typedef Event_Sequence< Float_Type, Kmer_Size > Event_Sequence_Type;
+    typedef Viterbi< Float_Type, Kmer_Size > Viterbi_Type;
+    typedef typename Viterbi_Type::Traceback_Type Traceback_Type;
+
+    static const unsigned n_states = Pore_Model_Type::n_states;
+
+    // maximum number of uncommitted events; 0: no limit
+    static unsigned& max_lag() { static unsigned _max_lag = 1000; return _max_lag; }
+
+    // lag: maximum number of uncommitted events for this decoder; 0 keeps the decoding exact
+    Online_Viterbi(const Pore_Model_Type& pm, const State_Transitions_Type& st, unsigned lag = max_lag())
+        : _pm_p(&pm), _st_p(&st), _max_lag(lag), _last_state_taken(0), _n_events(0), _n_committed(0), _n_taken(0),
+          _anchor(0), _ring_begin(0), _n_rows(0), _path_probability(-INFINITY) {}
+
+    unsigned n_events() const { return _n_events; }
+    // events [0, n_committed()) have final states
+    unsigned n_committed() const { return _n_committed; }
+    // only meaningful after finish()
+    Float_Type path_probability() const { return _path_probability; }
+    // scores of the best paths ending in each state at the last event pushed
+    const Float_Type* last_column() const { assert(_n_events > 0); return _vit.last_column(); }
+
+    // consume one event; returns the number of events committed as a result
+    unsigned push(const Event_Type& e)
+    {
+        unsigned old_n_committed = _n_committed;
+        if (_n_events == 0)
+        {
+            _vit.begin(*_pm_p, *_st_p, e);
+            _label_crt.resize(n_states);
+            _label_prev.resize(n_states);
+            reset_labels(0);
+        }
+        else
+        {
+            // the row of the event following a forced commit is never followed
+            _scratch_row.resize(n_states);
+            Traceback_Type* traceback_crt = _n_events > _n_committed? push_row() : &_scratch_row[0];
+            _vit.extend(*_pm_p, *_st_p, e, traceback_crt);
+            // propagate labels; states with no path left are ignored
+            const Float_Type* alpha_crt = _vit.last_column();
+            std::swap(_label_prev, _label_crt);
+            unsigned label = n_states;
+            bool converged = true;
+            for (unsigned j = 0; j < n_states; ++j)
+            {
+                _label_crt[j] = _label_prev[_vit.predecessor(*_st_p, traceback_crt[j], j)];
+                if (alpha_crt[j] == -INFINITY) continue;
+                if (label == n_states) label = _label_crt[j];
+                converged = converged and _label_crt[j] == label;
+            }
+            if (converged and label < n_states)
+            {
+                if (_anchor >= _n_committed)
+                {
+                    commit(_anchor, label);
+                }
+                reset_labels(_n_events);
+            }
+        }
+        ++_n_events;
+        if (_max_lag > 0 and _n_events - _n_committed > _max_lag)
+        {
+            // no convergence: commit along the best path, and force later paths through it
+            unsigned i = _n_events - 1;
+            Float_Type* alpha_crt = _vit.last_column();
+            unsigned j = std::max_element(alpha_crt, alpha_crt + n_states) - alpha_crt;
+            LOG("Online_Viterbi", debug) << "forced commit: i=" << i << " j=" << j << std::endl;
+            commit(i, j);
+            std::fill(alpha_crt, alpha_crt + j, -INFINITY);
+            std::fill(alpha_crt + j + 1, alpha_crt + n_states, -INFINITY);
+            reset_labels(i);
+        }
+        return _n_committed - old_n_committed;
+    }
+
+    // commit the remaining events along the best path
+    void finish()
+    {
+        if (_n_events == 0) return;
+        const Float_Type* alpha_crt = _vit.last_column();
+        unsigned j = std::max_element(alpha_crt, alpha_crt + n_states) - alpha_crt;
+        _path_probability = alpha_crt[j];
+        if (_n_committed < _n_events)
+        {
+            commit(_n_events - 1, j);
+        }
+    }
+
+    // states of the events committed since the last call to take_states() or take_bases()
+    std::vector< unsigned > take_states()
+    {
+        std::vector< unsigned > res;
+        res.swap(_state_v);
+        _n_taken = _n_committed;
+        return res;
+    }
+
+    // bases of the events committed since the last call to take_states() or take_bases()
+    std::string take_bases()
+    {
+        bool first = _n_taken == 0;
+        std::vector< unsigned > state_v = take_states();
+        std::string res;
+        res.reserve(state_v.size() + Kmer_Size);
+        char buf[Kmer_Size];
+        for (unsigned k = 0; k < state_v.size(); ++k)
+        {
+            unsigned move = Kmer_Size;
+            if (not first or k > 0)
+            {
+                move = std::min(Kmer_Type::min_skip(k > 0? state_v[k - 1] : _last_state_taken, state_v[k]), Kmer_Size);
+            }
+            res.append(buf, Event_Sequence_Type::write_bases(state_v[k], move, buf));
+        }
+        if (not state_v.empty())
+        {
+            _last_state_taken = state_v.back();
+        }
+        return res;
+    }
+
+private:
+    Viterbi_Type _vit;
+    const Pore_Model_Type* _pm_p;
+    const State_Transitions_Type* _st_p;
+    unsigned _max_lag;
+    // traceback rows of events (_n_committed, _n_events), in a ring buffer
+    DP_Arena_Vector< Traceback_Type > _ring;
+    std::vector< unsigned > _label_crt;
+    std::vector< unsigned > _label_prev;
+    std::vector< Traceback_Type > _scratch_row;
+    // committed states not taken yet, and the last state taken
+    std::vector< unsigned > _state_v;
+    unsigned _last_state_taken;
+    unsigned _n_events;
+    unsigned _n_committed;
+    unsigned _n_taken;
+    unsigned _anchor;
+    unsigned _ring_begin;
+    unsigned _n_rows;
+    Float_Type _path_probability;
+
+    // label every state of event i with itself
+    void reset_labels(unsigned i)
+    {
+        _anchor = i;
+        for (unsigned j = 0; j < n_states; ++j)
+        {
+            _label_crt[j] = j;
+        }
+    }
+
+    unsigned ring_capacity() const { return _ring.size() / n_states; }
+    // traceback row of event i
+    Traceback_Type* row(unsigned i)
+    {
+        assert(i > _n_committed and i - _n_committed <= _n_rows);
+        return &_ring[((_ring_begin + (i - _n_committed - 1)) % ring_capacity()) * n_states];
+    }
+
+    // add a row for the next event, growing the ring buffer if full
+    Traceback_Type* push_row()
+    {
+        if (_n_rows == ring_capacity())
+        {
+            DP_Arena_Vector< Traceback_Type > new_ring(std::max(2 * _n_rows, 16u) * n_states);
+            for (unsigned k = 0; k < _n_rows; ++k)
+            {
+                const Traceback_Type* src = &_ring[((_ring_begin + k) % ring_capacity()) * n_states];
+                std::copy(src, src + n_states, &new_ring[k * n_states]);
+            }
+            _ring.swap(new_ring);
+            _ring_begin = 0;
+        }
+        ++_n_rows;
+        return row(_n_committed + _n_rows);
+    }
+
+    // commit events [_n_committed, i], where event i is in state j
+    void commit(unsigned i, unsigned j)
+    {
+        assert(i >= _n_committed and i < _n_events);
+        unsigned n = i + 1 - _n_committed;
+        size_t offset = _state_v.size();
+        _state_v.resize(offset + n);
+        for (unsigned k = i; ; --k)
+        {
+            _state_v[offset + (k - _n_committed)] = j;
+            if (k == _n_committed) break;
+            j = _vit.predecessor(*_st_p, row(k)[j], j);
+        }
+        // release the rows of events up to i; row i + 1 links to the committed state
+        unsigned n_released = std::min(n, _n_rows);
+        _ring_begin = (_ring_begin + n_released) % std::max(ring_capacity(), 1u);
+        _n_rows -= n_released;
+        _n_committed = i + 1;
+        LOG("Online_Viterbi", debug1) << "committed: n_committed=" << _n_committed << std::endl;
+    }
+}; // class Online_Viterbi
+
+#endif
@@ -1,6 +1,7 @@
 #ifndef __PARAMETER_TRAINER
 #define __PARAMETER_TRAINER
 
+#include <algorithm>
 #include <array>
 #include <vector>
 #include <map>
@@ -9,7 +10,6 @@
 #include "Pore_Model.hpp"
 #include "State_Transitions.hpp"
 #include "Forward_Backward.hpp"
-#include "logsumset.hpp"
 #include "logger.hpp"
 
 template < typename Float_Type, unsigned Kmer_Size = 6 >
@@ -23,7 +23,7 @@ struct Parameter_Trainer
     typedef Event< Float_Type, Kmer_Size > Event_Type;
     typedef Event_Sequence< Float_Type, Kmer_Size > Event_Sequence_Type;
     typedef Forward_Backward< Float_Type, Kmer_Size > Forward_Backward_Type;
-    typedef logsum::logsumset< Float_Type > LogSumSet_Type;
+    typedef Emission_Matrix< Float_Type, Kmer_Size > Emission_Matrix_Type;
 
     static const unsigned n_states = Pore_Model_Type::n_states;
 
@@ -68,6 +68,220 @@ struct Parameter_Trainer
         return _pm_train_drift;
     }
 
+    // posterior mass of every event kept by the sparse posterior lists; >= 1: keep all states
+    static Float_Type& posterior_mass()
+    {
+        static Float_Type _posterior_mass = 0.999;
+        return _posterior_mass;
+    }
+
+    /**
+     * Sparse posteriors of an event sequence: for every event, the list of its most likely
+     * states, with their posteriors, covering posterior_mass() of its mass.
+     * States with posterior at most (1 - posterior_mass()) / n_states are never kept;
+     * together, they hold less than the mass allowed to be dropped. The kept posteriors
+     * are renormalized to sum 1, so every event keeps its full weight in the statistics.
+     */
+    struct Sparse_Posteriors
+    {
+        typedef std::pair< unsigned, Float_Type > Entry_Type;
+        typedef typename std::vector< Entry_Type >::const_iterator const_iterator;
+
+        std::vector< Entry_Type > entry_v;
+        // entries of event i: [range_v[i].first, range_v[i].second)
+        std::vector< std::pair< unsigned, unsigned > > range_v;
+        // posterior mass dropped: total, and max over events
+        double pruned_mass;
+        double max_pruned_mass;
+
+        void clear(unsigned n_events)
+        {
+            entry_v.clear();
+            range_v.assign(n_events, std::make_pair(0u, 0u));
+            pruned_mass = 0.0;
+            max_pruned_mass = 0.0;
+        }
+        unsigned n_events() const { return range_v.size(); }
+        const_iterator begin(unsigned i) const { return entry_v.begin() + range_v[i].first; }
+        const_iterator end(unsigned i) const { return entry_v.begin() + range_v[i].second; }
+
+        // set the list of event i from its dense posteriors p
+        void add(unsigned i, const Float_Type* p)
+        {
+            Float_Type mass = posterior_mass();
+            Float_Type threshold = mass < 1? (1 - mass) / n_states : 0;
+            unsigned first = entry_v.size();
+            double total = 0.0;
+            for (unsigned j = 0; j < n_states; ++j)
+            {
+                total += p[j];
+                if (p[j] > threshold)
+                {
+                    entry_v.push_back(std::make_pair(j, p[j]));
+                }
+            }
+            double kept = 0.0;
+            if (mass < 1)
+            {
+                // keep the most likely states until the mass is covered
+                std::sort(entry_v.begin() + first, entry_v.end(),
+                          [] (const Entry_Type& lhs, const Entry_Type& rhs) { return lhs.second > rhs.second; });
+                unsigned last = first;
+                while (last < entry_v.size() and kept < mass * total)
+                {
+                    kept += entry_v[last++].second;
+                }
+                entry_v.resize(last);
+            }
+            else
+            {
+                kept = total;
+            }
+            if (kept > 0)
+            {
+                Float_Type inv_kept = 1 / kept;
+                for (unsigned k = first; k < entry_v.size(); ++k)
+                {
+                    entry_v[k].second *= inv_kept;
+                }
+            }
+            range_v[i] = std::make_pair(first, static_cast< unsigned >(entry_v.size()));
+            pruned_mass += total - kept;
+            max_pruned_mass = std::max(max_pruned_mass, total - kept);
+        }
+    }; // struct Sparse_Posteriors
+
+    /**
+     * Per-state factors of the scaling statistics of an unscaled pore model, in SoA form:
+     * 1/sigma^2, mu/sigma^2, mu^2/sigma^2, lambda, lambda/eta, lambda/eta^2.
+     */
+    struct Pm_Stats_Weights
+    {
+        std::array< std::vector< Float_Type >, 6 > w;
+
+        void init(const Pore_Model_Type& pm)
+        {
+            for (auto& v : w)
+            {
+                v.resize(n_states);
+            }
+            for (unsigned j = 0; j < n_states; ++j)
+            {
+                const auto& s = pm.state(j);
+                w[0][j] = 1 / (s.level_stdv * s.level_stdv);
+                w[1][j] = w[0][j] * s.level_mean;
+                w[2][j] = w[1][j] * s.level_mean;
+                w[3][j] = s.sd_lambda;
+                w[4][j] = w[3][j] / s.sd_mean;
+                w[5][j] = w[4][j] / s.sd_mean;
+            }
+        }
+    }; // struct Pm_Stats_Weights
+
+    /**
+     * Sufficient statistics of the scaling parameters (against the unscaled pm and
+     * uncorrected events), accumulated one event at a time from its state posteriors.
+     */
+    struct Pm_Stats
+    {
+        std::array< std::array< double, 3 >, 3 > A;
+        std::array< double, 3 > B;
+        double D;       // = \sum_i x^2_i s_{i,0} (used for var)
+        double V_numer; // = \sum_i y_i \sum_j p_{i,j} \lambda_j / \eta^2_j (for scale_sd)
+        double V_denom; // = \sum_i \sum_j p_{i,j} \lambda_j / \eta_j (for scale_sd)
+        double U_pos;   // = \sum_i (1/y_i) \sum_j p_{i,j} \lambda_j (for var_sd)
+        unsigned n_events;
+
+        void clear()
+        {
+            A = {{ {{ 0.0, 0.0, 0.0 }}, {{ 0.0, 0.0, 0.0 }}, {{ 0.0, 0.0, 0.0 }} }};
+            B = {{ 0.0, 0.0, 0.0 }};
+            D = 0.0;
+            V_numer = 0.0;
+            V_denom = 0.0;
+            U_pos = 0.0;
+            n_events = 0;
+        }
+
+        // add event e, with the state posteriors in [first, last)
+        template < typename Iterator >
+        void add(const Pm_Stats_Weights& pw, const Event_Type& e, Iterator first, Iterator last)
+        {
+            Float_Type x_i = e.mean;
+            Float_Type y_i = e.stdv;
+            Float_Type t_i = e.start;
+            // s[k] = \sum_j p_{i,j} \mu^k_j / \sigma^2_j
+            // l[k] = \sum_j p_{i,j} \lambda_j / \eta^k_j
+            std::array< Float_Type, 6 > t = {{ 0.0, 0.0, 0.0, 0.0, 0.0, 0.0 }};
+            for (auto it = first; it != last; ++it)
+            {
+                for (unsigned r = 0; r < 6; ++r)
+                {
+                    t[r] += it->second * pw.w[r][it->first];
+                }
+            }
+            const Float_Type* s = &t[0];
+            const Float_Type* l = &t[3];
+            LOG(debug2)
+                << "pm_stats x_i=" << x_i << " t_i=" << t_i
+                << " s0=" << s[0] << " s1=" << s[1] << " s2=" << s[2]
+                << " l0=" << l[0] << " l1=" << l[1] << " l2=" << l[2] << std::endl;
+            A[0][0] += s[0];
+            A[0][1] += s[1];
+            A[1][1] += s[2];
+            B[0]    += s[0] * x_i;
+            B[1]    += s[1] * x_i;
+            if (pm_train_drift())
+            {
+                A[0][2] += s[0] * t_i;
+                A[1][2] += s[1] * t_i;
+                A[2][2] += s[0] * t_i * t_i;
+                B[2]    += s[0] * x_i * t_i;
+            }
+            D       += s[0] * x_i * x_i;
+            V_numer += l[2] * y_i;
+            V_denom += l[1];
+            U_pos   += l[0] / y_i;
+            ++n_events;
+        }
+    }; // struct Pm_Stats
+
+    /**
+     * Expected transitions out of the st_train_kmers() states, accumulated from the
+     * transition posteriors of the fwbw backward pass.
+     * @denom Posterior mass of the training states, over all events but the last
+     * @stay_num Mass staying in the same state at the next event
+     * @step_num Mass stepping to a 1-step neighbour at the next event; skips get the rest
+     */
+    struct St_Stats
+    {
+        double denom;
+        double stay_num;
+        double step_num;
+
+        void clear()
+        {
+            denom = 0.0;
+            stay_num = 0.0;
+            step_num = 0.0;
+        }
+        // add the transitions of an event, given as in Forward_Backward::stream_posteriors_and_transitions()
+        void add(const Float_Type* a, const Float_Type* w, Float_Type inv_z,
+                 Float_Type p_stay, Float_Type p_step_4)
+        {
+            double stay = 0.0;
+            double step = 0.0;
+            for (auto j1 : st_train_kmers())
+            {
+                const auto& nl = Kmer_Type::neighbour_list(j1, 1);
+                stay += a[j1] * w[j1];
+                step += a[j1] * (w[nl[0]] + w[nl[1]] + w[nl[2]] + w[nl[3]]);
+            }
+            stay_num += stay * p_stay * inv_z;
+            step_num += step * p_step_4 * inv_z;
+        }
+    }; // struct St_Stats
+
     /**
      * Struct used for training rounds.
      * @event_seq_ptr_v Vector of pairs, first: an event sequence, second: strand from which it comes
@@ -75,6 +289,8 @@ struct Parameter_Trainer
      * @default_transitions_ptr Default state transitions
      * @pm_params_ptr Pore model scaling parameters (common to both strands)
      * @st_params_ptr_v State transition parameters (per strand)
+     * The output fields are overwritten by fill_train_data, reusing their storage,
+     * so the same object should be passed to all the rounds on a read.
      */
     struct Train_Data
     {
@@ -84,12 +300,25 @@ struct Parameter_Trainer
         const State_Transitions_Type* default_transitions_ptr;
         const Pore_Model_Parameters_Type* pm_params_ptr;
         std::array< const State_Transition_Parameters_Type*, 2 > st_params_ptr_v;
+        bool train_scaling;
+        bool train_transitions;
         // output
         std::array< Pore_Model_Type, 2 > scaled_model_v;
         std::array< State_Transitions_Type, 2 > custom_transitions_v;
         std::array< const State_Transitions_Type*, 2 > transitions_ptr_v;
-        std::vector< Event_Sequence_Type > corrected_event_seq_v;
+        // emissions of the scaled model (which corrects drift) on the sequence being processed,
+        // empty if too large; fwbw engines, whose matrices are only filled when dumping training data
+        Emission_Matrix_Type emission;
         std::vector< Forward_Backward_Type > fwbw_v;
+        // sparse posteriors of the sequences, and their pruned mass per event: average and max
+        std::vector< Sparse_Posteriors > sparse_posterior_v;
+        double avg_pruned_mass;
+        double max_pruned_mass;
+        // scaling statistics, accumulated from the sparse posteriors as fwbw runs
+        std::array< Pm_Stats_Weights, 2 > pm_stats_weights_v;
+        Pm_Stats pm_stats;
+        // transition statistics (per strand), accumulated as fwbw runs
+        std::array< St_Stats, 2 > st_stats_v;
         Float_Type fit;
     };
 
@@ -110,6 +339,10 @@ struct Parameter_Trainer
             ASSERT(data.pm_params_ptr);
             data.scaled_model_v[p.second] = *data.model_ptr_v[p.second];
             data.scaled_model_v[p.second].scale(*data.pm_params_ptr);
+            if (data.train_scaling)
+            {
+                data.pm_stats_weights_v[p.second].init(*data.model_ptr_v[p.second]);
+            }
             init_scaled_models[p.second] = true;
         }
         // compute custom state transitions
@@ -131,27 +364,99 @@ struct Parameter_Trainer
             }
             init_transitions[p.second] = true;
         }
-        // compute drift-corrected event sequences
+        // the scaled models correct drift, so events are used as they are
+        // (resize, so that emission and DP storage from previous rounds is reused)
         unsigned n_event_seqs = data.event_seq_ptr_v.size();
-        data.corrected_event_seq_v.clear();
-        data.corrected_event_seq_v.reserve(n_event_seqs);
-        data.fwbw_v.clear();
-        data.fwbw_v.reserve(n_event_seqs);
+        data.fwbw_v.resize(n_event_seqs);
+        data.sparse_posterior_v.resize(n_event_seqs);
+        data.pm_stats.clear();
+        data.st_stats_v[0].clear();
+        data.st_stats_v[1].clear();
         data.fit = 0.0;
         for (unsigned k = 0; k < n_event_seqs; ++k)
         {
             unsigned st = data.event_seq_ptr_v[k].second;
             ASSERT(init_scaled_models[st]);
             ASSERT(init_transitions[st]);
-            // first, copy events
-            data.corrected_event_seq_v.emplace_back(*data.event_seq_ptr_v[k].first);
-            // then, apply drift correction
-            data.corrected_event_seq_v.back().apply_drift_correction(data.pm_params_ptr->drift);
-            // finally, run fwbw
-            data.fwbw_v.emplace_back();
-            data.fwbw_v.back().fill(
-                data.scaled_model_v[st], *data.transitions_ptr_v[st], data.corrected_event_seq_v.back());
-            data.fit += data.fwbw_v.back().log_pr_data();
+            const Event_Sequence_Type& events = *data.event_seq_ptr_v[k].first;
+            const Pm_Stats_Weights& pw = data.pm_stats_weights_v[st];
+            Sparse_Posteriors& sp = data.sparse_posterior_v[k];
+            St_Stats& ss = data.st_stats_v[st];
+            Float_Type p_stay = data.st_params_ptr_v[st]->p_stay;
+            Float_Type p_step_4 = (1.0 - data.st_params_ptr_v[st]->p_stay - data.st_params_ptr_v[st]->p_skip) / 4.0;
+            sp.clear(events.size());
+            auto add_posteriors = [&] (unsigned i, const Float_Type* p) {
+                sp.add(i, p);
+                if (data.train_scaling) data.pm_stats.add(pw, events[i], sp.begin(i), sp.end(i));
+                if (data.train_transitions and i + 1 < events.size())
+                {
+                    for (auto j1 : st_train_kmers())
+                    {
+                        ss.denom += p[j1];
+                    }
+                }
+            };
+            auto add_transitions = [&] (unsigned, const Float_Type* a, const Float_Type* w, Float_Type inv_z) {
+                ss.add(a, w, inv_z, p_stay, p_step_4);
+            };
+            // compute emissions once, for all fwbw passes on this sequence
+            data.emission.fill(data.scaled_model_v[st], events);
+            // stream posteriors from checkpoints, without keeping the matrix,
+            // unless it is needed to dump the training data
+            bool fill_matrix = false;
+#ifdef DUMP_TRAINING_DATA
+            fill_matrix = true;
+#endif
+            if (fill_matrix)
+            {
+                data.fwbw_v[k].fill(
+                    data.scaled_model_v[st], *data.transitions_ptr_v[st], events,
+                    &data.emission);
+                if (data.train_transitions)
+                {
+                    data.fwbw_v[k].stream_posteriors_and_transitions(
+                        data.scaled_model_v[st], events, add_posteriors, add_transitions);
+                }
+                else
+                {
+                    data.fwbw_v[k].stream_posteriors(add_posteriors);
+                }
+            }
+            else if (data.train_transitions)
+            {
+                data.fwbw_v[k].stream_posteriors_and_transitions(
+                    data.scaled_model_v[st], *data.transitions_ptr_v[st], events,
+                    add_posteriors, add_transitions, &data.emission);
+            }
+            else
+            {
+                data.fwbw_v[k].stream_posteriors(
+                    data.scaled_model_v[st], *data.transitions_ptr_v[st], events,
+                    add_posteriors, &data.emission);
+            }
+            data.fit += data.fwbw_v[k].log_pr_data();
+        }
+        {
+            unsigned n_events = 0;
+            size_t n_entries = 0;
+            data.avg_pruned_mass = 0.0;
+            data.max_pruned_mass = 0.0;
+            for (const auto& sp : data.sparse_posterior_v)
+            {
+                n_events += sp.n_events();
+                n_entries += sp.entry_v.size();
+                data.avg_pruned_mass += sp.pruned_mass;
+                data.max_pruned_mass = std::max(data.max_pruned_mass, sp.max_pruned_mass);
+            }
+            if (n_events > 0)
+            {
+                data.avg_pruned_mass /= n_events;
+            }
+            LOG(debug) << "sparse_posteriors posterior_mass [" << posterior_mass()
+                       << "] events [" << n_events
+                       << "] states_per_event [" << (n_events > 0? (double)n_entries / n_events : 0.0)
+                       << "] avg_pruned_mass [" << data.avg_pruned_mass
+                       << "] max_pruned_mass [" << data.max_pruned_mass << "]" << std::endl;
         }
 #ifdef DUMP_TRAINING_DATA
         for (unsigned k = 0; k < n_event_seqs; ++k)
@@ -167,7 +472,7 @@ struct Parameter_Trainer
                 for (unsigned j = 0; j < n_states; ++j)
                 {
                     if (j > 0) ofs << '\t';
-                    ofs << data.scaled_model_v[st].log_pr_corrected_emission(j, data.corrected_event_seq_v[k][i]);
+                    ofs << data.scaled_model_v[st].log_pr_corrected_emission(j, (*data.event_seq_ptr_v[k].first)[i]);
                 }
                 ofs << std::endl;
             }
@@ -223,19 +528,18 @@ struct Parameter_Trainer
 
     /**
      * Train pm_params on training data.
-     * @data Training data, as filled by fill_train_data.
+     * @data Training data, as filled by fill_train_data, with train_scaling set.
      * @new_pm_params Destination for new params.
      * @done Bool; if true, training failed, and no rounds are possible because of a singularity.
      */
     static void train_pm_params(const Train_Data& data, Pore_Model_Parameters_Type& new_pm_params, bool& done)
     {
         done = false;
-        unsigned n_event_seqs = data.event_seq_ptr_v.size();
-        unsigned total_n_events = 0;
         ASSERT(data.pm_params_ptr);
+        ASSERT(data.train_scaling);
         //
-        // compute the scaling matrices in normal space (not logspace!)
-        // against unscaled pm & uncorrected events
+        // the scaling matrices in normal space (not logspace!) against unscaled pm
+        // & uncorrected events were accumulated by fill_train_data
         //
         auto& a_hat = new_pm_params.shift;
         auto& b_hat = new_pm_params.scale;
@@ -243,75 +547,13 @@ struct Parameter_Trainer
         auto& d_hat = new_pm_params.var;
         auto& v_hat = new_pm_params.scale_sd;
         auto& u_hat = new_pm_params.var_sd;
-        std::array< std::array< double, 3 >, 3 > A = {{ {{ 0.0, 0.0, 0.0 }},
-                                                        {{ 0.0, 0.0, 0.0 }},
-                                                        {{ 0.0, 0.0, 0.0 }} }};
-        std::array< double, 3 > B = {{ 0.0, 0.0, 0.0 }};
-        double D       = 0.0; // = \sum_i x^2_i s_{i,0} (used for var)
-        double V_numer = 0.0; // = \sum_i y_i \sum_j p_{i,j} \lambda_j / \eta^2_j (for scale_sd)
-        double V_denom = 0.0; // = \sum_i \sum_j p_{i,j} \lambda_j / \eta_j (for scale_sd)
-        double U_pos   = 0.0; // = \sum_i (1/y_i) \sum_j p_{i,j} \lambda_j (for var_sd)
-        for (unsigned k = 0; k < n_event_seqs; ++k)
-        {
-            unsigned st = data.event_seq_ptr_v.at(k).second;
-            ASSERT(st < 2);
-            const Event_Sequence_Type& events = *data.event_seq_ptr_v[k].first;
-            unsigned n_events = events.size();
-            total_n_events += n_events;
-            const Pore_Model_Type& pm = *data.model_ptr_v[st];
-            const Forward_Backward_Type& fwbw = data.fwbw_v.at(k);
-            for (unsigned i = 0; i < n_events; ++i)
-            {
-                Float_Type x_i = events[i].mean;
-                Float_Type y_i = events[i].stdv;
-                Float_Type t_i = events[i].start;
-                LOG(debug1)
-                    << "outter_loop k=" << k << " i=" << i
-                    << " x_i=" << x_i
-                    << " t_i=" << t_i << std::endl;
-                // \sum_j p_{i,j} \mu^*_j / \simga^2_j
-                std::array< float, 3 > s = {{ 0.0, 0.0, 0.0 }};
-                // \sum_j p_{i,j} \lambda_j / \eta^*_j
-                std::array< float, 3 > l = {{ 0.0, 0.0, 0.0 }};
-                for (unsigned j = 0; j < Pore_Model_Type::n_states; ++j)
-                {
-                    Float_Type p_ij = std::exp(fwbw.log_posterior(i, j));
-                    Float_Type term_s0 = p_ij / (pm.state(j).level_stdv * pm.state(j).level_stdv);
-                    Float_Type term_s1 = term_s0 * pm.state(j).level_mean;
-                    Float_Type term_s2 = term_s1 * pm.state(j).level_mean;
-                    Float_Type term_l0 = p_ij * pm.state(j).sd_lambda;
-                    Float_Type term_l1 = term_l0 / pm.state(j).sd_mean;
-                    Float_Type term_l2 = term_l1 / pm.state(j).sd_mean;
-                    LOG(debug2)
-                        << "inner_loop k=" << k << " i=" << i << " j=" << j << " p_ij=" << p_ij
-                        << " term_s0=" << term_s0 << " term_s1=" << term_s1 << " term_s2=" << term_s2
-                        << " term_l0=" << term_l0 << " term_l1=" << term_l1 << " term_l2=" << term_l2
-                        << std::endl;
-                    s[0] += term_s0;
-                    s[1] += term_s1;
-                    s[2] += term_s2;
-                    l[0] += term_l0;
-                    l[1] += term_l1;
-                    l[2] += term_l2;
-                } // for j
-                A[0][0] += s[0];
-                A[0][1] += s[1];
-                A[1][1] += s[2];
-                B[0]    += s[0] * x_i;
-                B[1]    += s[1] * x_i;
-                if (pm_train_drift())
-                {
-                    A[0][2] += s[0] * t_i;
-                    A[1][2] += s[1] * t_i;
-                    A[2][2] += s[0] * t_i * t_i;
-                    B[2]    += s[0] * x_i * t_i;
-                }
-                D       += s[0] * x_i * x_i;
-                V_numer += l[2] * y_i;
-                V_denom += l[1];
-                U_pos   += l[0] / y_i;
-            } // for i
-        } // for k
+        unsigned total_n_events = data.pm_stats.n_events;
+        auto A = data.pm_stats.A;
+        auto B = data.pm_stats.B;
+        double D       = data.pm_stats.D;
+        double V_numer = data.pm_stats.V_numer;
+        double V_denom = data.pm_stats.V_denom;
+        double U_pos   = data.pm_stats.U_pos;
         A[1][0] = A[0][1];
         A[2][0] = A[0][2];
         A[2][1] = A[1][2];
@@ -434,87 +676,17 @@ struct Parameter_Trainer
     static void train_st_params(const Train_Data& data,
                                 std::array< State_Transition_Parameters_Type, 2 >& new_st_params)
     {
-        unsigned n_event_seqs = data.event_seq_ptr_v.size();
         for (unsigned st = 0; st < 2; ++st)
         {
             ASSERT(data.st_params_ptr_v[st]);
-            LogSumSet_Type s_p_stay_num(false);
-            LogSumSet_Type s_p_skip_num(false);
-            LogSumSet_Type s_denom(false);
-            Float_Type log_p_stay = std::log(data.st_params_ptr_v[st]->p_stay);
-            Float_Type log_p_step_4 = std::log(1.0 - data.st_params_ptr_v[st]->p_stay - data.st_params_ptr_v[st]->p_skip) - std::log(4.0);
-            for (unsigned k = 0; k < n_event_seqs; ++k)
-            {
-                if (data.event_seq_ptr_v[k].second != st) continue;
-                const Pore_Model_Type& scaled_pm = data.scaled_model_v[st];
-                const Event_Sequence_Type& corrected_events = data.corrected_event_seq_v.at(k);
-                unsigned n_events = corrected_events.size();
-                const Forward_Backward_Type& fwbw = data.fwbw_v.at(k);
-                //
-                // P[S_i = j1, S_{i+1} = j2]
-                //
-                auto log_joint_prob = [&] (unsigned i, unsigned j1, unsigned j2, Float_Type log_p_trans) {
-                    Float_Type p = fwbw.cell(i, j1).alpha
-                        + log_p_trans
-                        + scaled_pm.log_pr_corrected_emission(j2, corrected_events[i + 1])
-                        + fwbw.cell(i + 1, j2).beta
-                        - fwbw.log_pr_data();
-                    LOG(debug2) << "step_prob k=" << k
-                                << " i=" << i
-                                << " j1=" << Kmer_Type::to_string(j1)
-                                << " j2=" << Kmer_Type::to_string(j2)
-                                << " log_p_trans=" << log_p_trans
-                                << " res=" << p << std::endl;
-                    return p;
-                };
-
-                for (unsigned i = 0; i < n_events - 1; ++i)
-                {
-                    for (auto j1 : st_train_kmers())
-                    {
-                        // Pr[ S_i = j1 ]
-                        Float_Type log_p_j1 = fwbw.log_posterior(i, j1);
-                        s_denom.add(log_p_j1);
-                        // Pr[ S_i = j1, S_{i+1} = j1 ]
-                        Float_Type log_p_j1_j1 = log_joint_prob(i, j1, j1, log_p_stay);
-                        if (log_p_j1_j1 > log_p_j1)
-                        {
-                            if (log_p_j1_j1 > log_p_j1 + std::max(std::abs(log_p_j1), 1.0f) * 1.0e-3)
-                            {
-                                LOG(warning) << "numerical error log_p_j1 [" << log_p_j1
-                                             << "] log_p_j1_j1 [" << log_p_j1_j1 << "]" << std::endl;
-                            }
-                            log_p_j1_j1 = log_p_j1;
-                        }
-                        s_p_stay_num.add(log_p_j1_j1);
-                        // Pr[ S_i = j1, dist(j1,S_{i+1}) > 1 ]
-                        Float_Type log_p_j1_d01;
-                        {
-                            LogSumSet_Type s2(false);
-                            s2.add(log_p_j1_j1);
-                            for (auto j2 : Kmer_Type::neighbour_list(j1, 1))
-                            {
-                                // transition prob j1 to j2 is (p_step / 4)
-                                s2.add(log_joint_prob(i, j1, j2, log_p_step_4));
-                            }
-                            log_p_j1_d01 = s2.val();
-                        }
-                        if (log_p_j1_d01 > log_p_j1)
-                        {
-                            if (log_p_j1_d01 > log_p_j1 + std::max(std::abs(log_p_j1), 1.0f) * 1.0e-3)
-                            {
-                                LOG(warning) << "numerical error log_p_j1 [" << log_p_j1
-                                             << "] log_p_j1_d01 [" << log_p_j1_d01 << "]" << std::endl;
-                            }
-                            log_p_j1_d01 = log_p_j1;
-                        }
-                        Float_Type p_j1_d2 = std::exp(log_p_j1) - std::exp(log_p_j1_d01);
-                        s_p_skip_num.add(std::log(p_j1_d2));
-                    } // for j1
-                } // for i
-            } // for k
-            new_st_params[st].p_stay = std::exp(s_p_stay_num.val() - s_denom.val());
-            new_st_params[st].p_skip = std::exp(s_p_skip_num.val() - s_denom.val());
+            const St_Stats& ss = data.st_stats_v[st];
+            LOG(debug) << "st_stats strand [" << st
+                       << "] denom [" << ss.denom
+                       << "] stay_num [" << ss.stay_num
+                       << "] step_num [" << ss.step_num << "]" << std::endl;
+            // rounding can make the stays and steps exceed the total by a tiny amount
+            new_st_params[st].p_stay = ss.stay_num / ss.denom;
+            new_st_params[st].p_skip = std::max(ss.denom - ss.stay_num - ss.step_num, 0.0) / ss.denom;
             if (new_st_params[st].p_stay < .05 or new_st_params[st].p_stay > .4
                 or new_st_params[st].p_skip < .05 or new_st_params[st].p_skip > .4)
             {
@@ -533,12 +705,14 @@ struct Parameter_Trainer
 
     /**
      * Perform one training round.
+     * @data Training data storage, reused across rounds
      * @new_pm_params Destination for trained pm params (common to both strands)
      * @new_st_params Destination for trained st params (per strand)
      * @fit Destination for pr_data using crt params
      * @done Bool; set to true if no more training rounds can be performed due to singularity.
      */
     static void train_one_round(
+        Train_Data& data,
         const std::vector< std::pair< const Event_Sequence_Type*, unsigned > >& event_seq_ptrs,
         const std::array< const Pore_Model_Type*, 2 >& model_ptrs,
         const State_Transitions_Type& default_transitions,
@@ -552,12 +726,13 @@ struct Parameter_Trainer
         bool train_transitions)
     {
         // initialize training data
-        Train_Data data;
         data.event_seq_ptr_v = event_seq_ptrs;
         data.model_ptr_v = model_ptrs;
         data.default_transitions_ptr = &default_transitions;
         data.pm_params_ptr = &crt_pm_params;
         data.st_params_ptr_v = {{ &crt_st_params[0], &crt_st_params[1] }};
+        data.train_scaling = train_scaling;
+        data.train_transitions = train_transitions;
         // fill the training data
         fill_train_data(data);
         fit = data.fit;
@@ -9,34 +9,39 @@
 #ifndef __POREMODEL_HPP
 #define __POREMODEL_HPP
 
+#include <algorithm>
+#include <array>
 #include <cassert>
 #include <cmath>
 #include <iomanip>
 #include <iostream>
 #include <map>
 #include <string>
+#include <vector>
 
 #include "Kmer.hpp"
 #include "Event.hpp"
+#include "simd_support.hpp"
 #include "fast5.hpp"
 #include "alg.hpp"
 
+// log(2 * pi), as a compile-time constant
+constexpr double log_2pi = 1.8378770664093454835606594728112;
+
 template < typename Float_Type >
 inline Float_Type log_normal_pdf(Float_Type x, Float_Type mean, Float_Type stdv, Float_Type log_stdv)
 {
     // From SO: http://stackoverflow.com/questions/10847007/using-the-gaussian-probability-density-function-in-c
-    static const Float_Type log_2pi = std::log(2.0 * M_PI);
     Float_Type a = (x - mean) / stdv;
-    return - log_stdv - (log_2pi + a * a) / static_cast< Float_Type >(2.0);
+    return - log_stdv - (static_cast< Float_Type >(log_2pi) + a * a) / static_cast< Float_Type >(2.0);
 }
 
 template < typename Float_Type >
 inline Float_Type log_invgauss_pdf(Float_Type x, Float_Type log_x,
                                    Float_Type mu, Float_Type lambda, Float_Type log_lambda)
 {
-    static const Float_Type log_2pi = std::log(2.0 * M_PI);
     Float_Type a = (x - mu) / mu;
-    return (log_lambda - log_2pi - static_cast< Float_Type >(3.0) * log_x - lambda * a * a / x) / static_cast< Float_Type >(2.0);
+    return (log_lambda - static_cast< Float_Type >(log_2pi) - static_cast< Float_Type >(3.0) * log_x - lambda * a * a / x) / static_cast< Float_Type >(2.0);
 }
 
 template < typename Float_Type >
@@ -142,9 +147,10 @@ struct Pore_Model_State
         return (log_normal_pdf< Float_Type >(e.mean, level_mean, level_stdv, log_level_stdv)
                 + log_invgauss_pdf< Float_Type >(e.stdv, e.log_stdv, sd_mean, sd_lambda, log_sd_lambda));
     }
-    Float_Type log_pr_corrected_emission(const Event_Type& e) const
+    // emission of e with its mean corrected for drift
+    Float_Type log_pr_corrected_emission(const Event_Type& e, Float_Type drift) const
     {
-        return (log_normal_pdf< Float_Type >(e.corrected_mean, level_mean, level_stdv, log_level_stdv)
+        return (log_normal_pdf< Float_Type >(e.mean - drift * e.start, level_mean, level_stdv, log_level_stdv)
                 + log_invgauss_pdf< Float_Type >(e.stdv, e.log_stdv, sd_mean, sd_lambda, log_sd_lambda));
     }
 
@@ -172,9 +178,13 @@ public:
     typedef Event< Float_Type, Kmer_Size > Event_Type;
     typedef Pore_Model_State< Float_Type, Kmer_Size > Pore_Model_State_Type;
     typedef Pore_Model_Parameters< Float_Type > Pore_Model_Parameters_Type;
+    typedef simd::Vec< Float_Type > Vec_Type;
+    typedef simd::Scalar_Vec< Float_Type > Scalar_Vec_Type;
     static const unsigned n_states = 1u << (2 * Kmer_Size);
+    // events per block in the block emission kernel
+    static const unsigned event_block_size = 16;
 
-    Pore_Model() : _strand(2) {}
+    Pore_Model() : _drift(0.0), _strand(2) {}
     void clear() { _state.clear(); }
 
     const Pore_Model_State_Type& state(unsigned i) const { return _state.at(i); }
@@ -186,9 +196,13 @@ public:
     unsigned& strand() { return _strand; }
     Float_Type mean() const { return _mean; }
     Float_Type stdv() const { return _stdv; }
+    // drift of the scaling parameters; corrected emissions apply it to event means
+    Float_Type drift() const { return _drift; }
+    Float_Type corrected_mean(const Event_Type& e) const { return e.mean - _drift * e.start; }
 
     void scale(const Pore_Model_Parameters_Type& params)
     {
+        _drift = params.drift;
         Pore_Model_Parameters_Type log_params;
         log_params.var = std::log(params.var);
         log_params.scale_sd = std::log(params.scale_sd);
@@ -294,22 +308,210 @@ public:
     }
     Float_Type log_pr_corrected_emission(unsigned i, const Event_Type& e) const
     {
-        Float_Type res = state(i).log_pr_corrected_emission(e);
+        Float_Type res = state(i).log_pr_corrected_emission(e, _drift);
         return res;
     }
 
+    // exact corrected emissions of event e for states [j_begin, j_end), written to out[j];
+    // same values as log_pr_corrected_emission(), computed one SIMD vector of states at a time
+    void fill_exact_corrected_emissions(const Event_Type& e, Float_Type* out,
+                                        unsigned j_begin = 0, unsigned j_end = n_states) const
+    {
+        Event_Terms et(*this, e);
+        unsigned j_mid = j_begin + (j_end - j_begin) / Vec_Type::width * Vec_Type::width;
+        emission_kernel< Vec_Type >(_state_arrays, &et, 1, 0, out, j_begin, j_mid);
+        emission_kernel< Scalar_Vec_Type >(_state_arrays, &et, 1, 0, out, j_mid, j_end);
+    }
+
+    // exact corrected emissions of the events in [first, last), for all states:
+    // the emissions of event first + k are written to out + k * n_states; events are
+    // processed in blocks, so that the parameters of each state are loaded once per block
+    template < typename Event_Iterator >
+    void fill_exact_corrected_emissions(Event_Iterator first, Event_Iterator last, Float_Type* out) const
+    {
+        std::array< Event_Terms, event_block_size > et;
+        while (first != last)
+        {
+            unsigned n = 0;
+            for (; n < event_block_size and first != last; ++n, ++first)
+            {
+                et[n] = Event_Terms(*this, *first);
+            }
+            emission_kernel< Vec_Type >(_state_arrays, et.data(), n, n_states, out, 0, n_states);
+            out += static_cast< size_t >(n) * n_states;
+        }
+    }
+
+    // if positive, emissions of states with level_mean further than this many (maximum)
+    // level_stdv from the corrected event mean are not computed exactly; 0: exact everywhere
+    static Float_Type& sparse_emission_stdvs() { static Float_Type _sparse_emission_stdvs = 0.0; return _sparse_emission_stdvs; }
+
+    // states in increasing order of level_mean
+    const std::vector< unsigned >& level_order() const { return _level_order; }
+
+    // range [first, second) of level_order() holding the states within
+    // sparse_emission_stdvs() of the corrected mean of e; never empty
+    std::pair< unsigned, unsigned > emission_candidates(const Event_Type& e) const
+    {
+        Float_Type x = corrected_mean(e);
+        Float_Type d = sparse_emission_stdvs() * _max_level_stdv;
+        unsigned lo = std::lower_bound(_sorted_level.begin(), _sorted_level.end(), x - d) - _sorted_level.begin();
+        unsigned hi = std::upper_bound(_sorted_level.begin() + lo, _sorted_level.end(), x + d) - _sorted_level.begin();
+        if (lo == hi)
+        {
+            // no state in range: take the closest one
+            if (hi == n_states or (lo > 0 and x - _sorted_level[lo - 1] < _sorted_level[hi] - x)) --lo;
+            else ++hi;
+        }
+        return std::make_pair(lo, hi);
+    }
+
+    // corrected emissions of event e for states [j_begin, j_end), written to out[j].
+    // With sparse_emission_stdvs(), only the candidate states are computed exactly;
+    // the others get a floor: the lowest emission among the candidates and the two states
+    // closest to the range, so that a state outside the range is never favoured.
+    void fill_corrected_emissions(const Event_Type& e, Float_Type* out,
+                                  unsigned j_begin = 0, unsigned j_end = n_states) const
+    {
+        if (sparse_emission_stdvs() <= 0.0)
+        {
+            fill_exact_corrected_emissions(e, out, j_begin, j_end);
+            return;
+        }
+        // candidates are contiguous in level order: compute them, and the states on either
+        // side, with the SIMD kernel on the level-ordered parameters
+        auto r = emission_candidates(e);
+        unsigned k_begin = r.first > 0? r.first - 1 : 0;
+        unsigned k_end = std::min(r.second + 1, n_states);
+        Float_Type buf[n_states];
+        Event_Terms et(*this, e);
+        unsigned k_mid = k_begin + (k_end - k_begin) / Vec_Type::width * Vec_Type::width;
+        emission_kernel< Vec_Type >(_sorted_arrays, &et, 1, 0, buf, k_begin, k_mid);
+        emission_kernel< Scalar_Vec_Type >(_sorted_arrays, &et, 1, 0, buf, k_mid, k_end);
+        std::fill(out + j_begin, out + j_end, *std::min_element(buf + k_begin, buf + k_end));
+        for (unsigned k = r.first; k < r.second; ++k)
+        {
+            unsigned j = _level_order[k];
+            if (j_begin <= j and j < j_end)
+            {
+                out[j] = buf[k];
+            }
+        }
+    }
+
 private:
     std::vector< Pore_Model_State_Type > _state;
+    // state parameters used by the emission kernel, one array each (SoA)
+    struct State_Arrays
+    {
+        std::vector< Float_Type > level_mean;
+        std::vector< Float_Type > level_stdv;
+        std::vector< Float_Type > log_level_stdv;
+        std::vector< Float_Type > sd_mean;
+        std::vector< Float_Type > sd_lambda;
+        // log_sd_lambda - log_2pi
+        std::vector< Float_Type > log_sd_lambda_m_log_2pi;
+
+        void resize(unsigned n)
+        {
+            level_mean.resize(n);
+            level_stdv.resize(n);
+            log_level_stdv.resize(n);
+            sd_mean.resize(n);
+            sd_lambda.resize(n);
+            log_sd_lambda_m_log_2pi.resize(n);
+        }
+        void set(unsigned k, const Pore_Model_State_Type& s)
+        {
+            level_mean[k] = s.level_mean;
+            level_stdv[k] = s.level_stdv;
+            log_level_stdv[k] = s.log_level_stdv;
+            sd_mean[k] = s.sd_mean;
+            sd_lambda[k] = s.sd_lambda;
+            log_sd_lambda_m_log_2pi[k] = s.log_sd_lambda - static_cast< Float_Type >(log_2pi);
+        }
+    };
+    // in state order, and in level order; rebuilt with the level index
+    State_Arrays _state_arrays;
+    State_Arrays _sorted_arrays;
+    // level index, rebuilt whenever levels change
+    std::vector< unsigned > _level_order;
+    std::vector< Float_Type > _sorted_level;
+    Float_Type _max_level_stdv;
+    Float_Type _drift;
     Float_Type _mean;
     Float_Type _stdv;
     unsigned _strand;
 
+    // event terms of the emission
+    struct Event_Terms
+    {
+        Float_Type x;
+        Float_Type sd;
+        Float_Type three_log_sd;
+        Event_Terms() = default;
+        Event_Terms(const Pore_Model& pm, const Event_Type& e)
+            : x(pm.corrected_mean(e)), sd(e.stdv), three_log_sd(static_cast< Float_Type >(3.0) * e.log_stdv) {}
+    };
+
+    // emissions of n_events events for states [j_begin, j_end), a multiple of V::width;
+    // event k is written to out + k * stride; same operations as log_normal_pdf + log_invgauss_pdf
+    template < typename V >
+    static void emission_kernel(const State_Arrays& sa, const Event_Terms* et, unsigned n_events, size_t stride,
+                                Float_Type* out, unsigned j_begin, unsigned j_end)
+    {
+        auto zero = V::set1(0.0);
+        auto half = V::set1(0.5);
+        auto log_2pi_v = V::set1(static_cast< Float_Type >(log_2pi));
+        for (unsigned j = j_begin; j < j_end; j += V::width)
+        {
+            auto level_mean = V::load(&sa.level_mean[j]);
+            auto level_stdv = V::load(&sa.level_stdv[j]);
+            auto neg_log_level_stdv = V::sub(zero, V::load(&sa.log_level_stdv[j]));
+            auto sd_mean = V::load(&sa.sd_mean[j]);
+            auto sd_lambda = V::load(&sa.sd_lambda[j]);
+            auto log_sd_lambda_m_log_2pi = V::load(&sa.log_sd_lambda_m_log_2pi[j]);
+            for (unsigned k = 0; k < n_events; ++k)
+            {
+                auto x = V::set1(et[k].x);
+                auto sd = V::set1(et[k].sd);
+                // log_normal_pdf
+                auto a = V::div(V::sub(x, level_mean), level_stdv);
+                auto r = V::sub(neg_log_level_stdv, V::mul(V::add(log_2pi_v, V::mul(a, a)), half));
+                // log_invgauss_pdf
+                auto b = V::div(V::sub(sd, sd_mean), sd_mean);
+                auto t = V::sub(log_sd_lambda_m_log_2pi, V::set1(et[k].three_log_sd));
+                t = V::sub(t, V::div(V::mul(V::mul(sd_lambda, b), b), sd));
+                V::store(out + k * stride + j, V::add(r, V::mul(t, half)));
+            }
+        }
+    }
+
     void update_statistics()
     {
         assert(_state.size() == n_states);
         std::tie(_mean, _stdv) = alg::mean_stdv_of< Float_Type >(
             _state,
             [] (const Pore_Model_State_Type& s) { return s.level_mean; });
+        _level_order.resize(n_states);
+        for (unsigned j = 0; j < n_states; ++j)
+        {
+            _level_order[j] = j;
+        }
+        std::sort(_level_order.begin(), _level_order.end(), [&] (unsigned j1, unsigned j2) {
+            return state(j1).level_mean < state(j2).level_mean;
+        });
+        _state_arrays.resize(n_states);
+        _sorted_arrays.resize(n_states);
+        _sorted_level.resize(n_states);
+        _max_level_stdv = 0.0;
+        for (unsigned k = 0; k < n_states; ++k)
+        {
+            _state_arrays.set(k, state(k));
+            _sorted_arrays.set(k, state(_level_order[k]));
+            _sorted_level[k] = state(_level_order[k]).level_mean;
+            _max_level_stdv = std::max(_max_level_stdv, state(_level_order[k]).level_stdv);
+        }
     }
 }; // class Pore_Model
 
@@ -1,14 +1,17 @@
 #ifndef __STATE_TRANSITIONS_BASE_HPP
 #define __STATE_TRANSITIONS_BASE_HPP
 
+#include <algorithm>
+#include <array>
 #include <cassert>
 #include <cmath>
 #include <iostream>
 #include <vector>
 #include <map>
+#include <set>
 
 #include "Kmer.hpp"
-#include "logsumset.hpp"
+#include "Log_Sum_Exp.hpp"
 #include "logger.hpp"
 
 template < typename Float_Type >
@@ -60,6 +63,183 @@ struct State_Neighbours
     Float_Type p_rest_to;
 }; // struct State_Neighbours
 
+/*
+ * SoA view of a transition table with the fixed predecessor shape produced by
+ * State_Transitions::compute_transitions_fast(). Every state j has 21 predecessor slots:
+ * - slot 0: j itself (stay)
+ * - slots 1..4: the 4 states whose (Kmer_Size-1)-suffix is the (Kmer_Size-1)-prefix of j (step)
+ * - slots 5..20: the 16 states whose (Kmer_Size-2)-suffix is the (Kmer_Size-2)-prefix of j (skip)
+ * A state can occupy several slots (e.g. homopolymers); each copy holds the full transition.
+ * Absent transitions hold -INFINITY. If some transition falls outside this shape, valid is false.
+ *
+ * A state j is regular if its stay, step and skip predecessors are pairwise distinct, and
+ * all step (resp. skip) predecessors reach j with the same transition probability. The DP
+ * recursion into a regular state then factors through per-group maxima/sums: the step group
+ * of j is shared by the 4 states with the same (Kmer_Size-1)-prefix, the skip group by the 16
+ * states with the same (Kmer_Size-2)-prefix. Irregular states (homopolymer-like kmers) are few,
+ * and must be handled through their predecessor lists.
+ */
+template < typename Float_Type, unsigned Kmer_Size >
+struct Fixed_Shape_Transitions
+{
+    static_assert(Kmer_Size >= 2, "fixed transition shape needs Kmer_Size >= 2");
+    typedef State_Neighbours< Float_Type > State_Neighbours_Type;
+    static const unsigned n_states = 1u << (2 * Kmer_Size);
+    static const unsigned n_slots = 21;
+    static const unsigned n_step_groups = n_states / 4;
+    static const unsigned n_skip_groups = n_states / 16;
+
+    // predecessor of state j in slot s
+    static unsigned pred(unsigned s, unsigned j)
+    {
+        return (s == 0
+                ? j
+                : (s < 5
+                   ? ((s - 1) << (2 * (Kmer_Size - 1))) + (j >> 2)
+                   : ((s - 5) << (2 * (Kmer_Size - 2))) + (j >> 4)));
+    }
+
+    Fixed_Shape_Transitions() : valid(false), grouped(false) {}
+
+    // log transition probability from pred(s, j) to j
+    Float_Type log_pr(unsigned s, unsigned j) const { return log_pr_v[s * n_states + j]; }
+    const Float_Type* log_pr_slot(unsigned s) const { return &log_pr_v[s * n_states]; }
+
+    // grouped form; g: 0 = stay, 1 = step, 2 = skip; -INFINITY for irregular states
+    Float_Type log_pr_group(unsigned g, unsigned j) const { return log_pr_group_v[g * n_states + j]; }
+    const Float_Type* log_pr_group_slice(unsigned g) const { return &log_pr_group_v[g * n_states]; }
+    bool is_regular(unsigned j) const { return regular_v[j]; }
+    // linear probabilities of the grouped form; 0 for irregular states
+    const Float_Type* pr_group_slice(unsigned g) const { return &pr_group_v[g * n_states]; }
+
+    // transitions from state j into irregular states
+    typename std::vector< std::pair< unsigned, Float_Type > >::const_iterator irregular_to_begin(unsigned j) const
+    {
+        return irregular_to_v.begin() + irregular_to_start_v[j];
+    }
+    typename std::vector< std::pair< unsigned, Float_Type > >::const_iterator irregular_to_end(unsigned j) const
+    {
+        return irregular_to_v.begin() + irregular_to_start_v[j + 1];
+    }
+    // linear probability of irregular_to_v[k]
+    Float_Type irregular_to_pr(unsigned k) const { return irregular_to_pr_v[k]; }
+    unsigned irregular_to_start(unsigned j) const { return irregular_to_start_v[j]; }
+
+    // predecessors of the irregular state irregular_v[k], with linear probabilities
+    typename std::vector< std::pair< unsigned, Float_Type > >::const_iterator irregular_from_begin(unsigned k) const
+    {
+        return irregular_from_v.begin() + irregular_from_start_v[k];
+    }
+    typename std::vector< std::pair< unsigned, Float_Type > >::const_iterator irregular_from_end(unsigned k) const
+    {
+        return irregular_from_v.begin() + irregular_from_start_v[k + 1];
+    }
+
+    void init(const std::vector< State_Neighbours_Type >& neighbours)
+    {
+        valid = false;
+        grouped = false;
+        log_pr_v.assign(n_slots * n_states, -INFINITY);
+        if (neighbours.size() != n_states) return;
+        for (unsigned j = 0; j < n_states; ++j)
+        {
+            for (const auto& p : neighbours[j].from_v)
+            {
+                bool found = false;
+                for (unsigned s = 0; s < n_slots; ++s)
+                {
+                    if (pred(s, j) == p.first)
+                    {
+                        log_pr_v[s * n_states + j] = p.second;
+                        found = true;
+                    }
+                }
+                if (not found)
+                {
+                    log_pr_v.clear();
+                    return;
+                }
+            }
+        }
+        valid = true;
+        init_groups(neighbours);
+    }
+
+    std::vector< Float_Type > log_pr_v;
+    std::vector< Float_Type > log_pr_group_v;
+    std::vector< bool > regular_v;
+    std::vector< unsigned > irregular_v;
+    std::vector< unsigned > irregular_to_start_v;
+    std::vector< std::pair< unsigned, Float_Type > > irregular_to_v;
+    // linear-space copies, for engines working with probabilities
+    std::vector< Float_Type > pr_group_v;
+    std::vector< Float_Type > irregular_to_pr_v;
+    std::vector< unsigned > irregular_from_start_v;
+    std::vector< std::pair< unsigned, Float_Type > > irregular_from_v;
+    bool valid;
+    bool grouped;
+
+private:
+    void init_groups(const std::vector< State_Neighbours_Type >& neighbours)
+    {
+        log_pr_group_v.assign(3 * n_states, -INFINITY);
+        regular_v.assign(n_states, true);
+        irregular_v.clear();
+        irregular_from_start_v.assign(1, 0);
+        irregular_from_v.clear();
+        std::vector< std::vector< std::pair< unsigned, Float_Type > > > irregular_to(n_states);
+        for (unsigned j = 0; j < n_states; ++j)
+        {
+            std::array< unsigned, n_slots > pred_a;
+            for (unsigned s = 0; s < n_slots; ++s)
+            {
+                pred_a[s] = pred(s, j);
+            }
+            std::sort(pred_a.begin(), pred_a.end());
+            bool regular = std::adjacent_find(pred_a.begin(), pred_a.end()) == pred_a.end();
+            for (unsigned s = 2; regular and s < n_slots; ++s)
+            {
+                if (s != 5 and log_pr(s, j) != log_pr(s < 5? 1 : 5, j))
+                {
+                    regular = false;
+                }
+            }
+            if (regular)
+            {
+                log_pr_group_v[0 * n_states + j] = log_pr(0, j);
+                log_pr_group_v[1 * n_states + j] = log_pr(1, j);
+                log_pr_group_v[2 * n_states + j] = log_pr(5, j);
+            }
+            else
+            {
+                regular_v[j] = false;
+                irregular_v.push_back(j);
+                for (const auto& p : neighbours[j].from_v)
+                {
+                    irregular_to[p.first].push_back(std::make_pair(j, p.second));
+                    irregular_from_v.push_back(std::make_pair(p.first, std::exp(p.second)));
+                }
+                irregular_from_start_v.push_back(irregular_from_v.size());
+            }
+        }
+        irregular_to_start_v.assign(1, 0);
+        irregular_to_v.clear();
+        for (unsigned j = 0; j < n_states; ++j)
+        {
+            irregular_to_v.insert(irregular_to_v.end(), irregular_to[j].begin(), irregular_to[j].end());
+            irregular_to_start_v.push_back(irregular_to_v.size());
+        }
+        pr_group_v.resize(log_pr_group_v.size());
+        std::transform(log_pr_group_v.begin(), log_pr_group_v.end(), pr_group_v.begin(),
+                       [] (Float_Type v) { return std::exp(v); });
+        irregular_to_pr_v.resize(irregular_to_v.size());
+        std::transform(irregular_to_v.begin(), irregular_to_v.end(), irregular_to_pr_v.begin(),
+                       [] (const std::pair< unsigned, Float_Type >& p) { return std::exp(p.second); });
+        // grouping only pays off if few states need the explicit recursion
+        grouped = irregular_v.size() <= n_states / 16;
+    }
+}; // struct Fixed_Shape_Transitions
+
 template < typename Float_Type, unsigned Kmer_Size = 6 >
 class State_Transitions
 {
@@ -67,14 +247,18 @@ public:
     typedef Kmer< Kmer_Size > Kmer_Type;
     typedef State_Neighbours< Float_Type > State_Neighbours_Type;
     typedef State_Transition_Parameters< Float_Type > State_Transition_Parameters_Type;
+    typedef Fixed_Shape_Transitions< Float_Type, Kmer_Size > Fixed_Shape_Transitions_Type;
     static const unsigned n_states = 1u << (2 * Kmer_Size);
 
     State_Transitions() = default;
-    void clear() { _neighbours.clear(); }
+    void clear() { _neighbours.clear(); _fixed_shape = Fixed_Shape_Transitions_Type(); }
 
     const State_Neighbours_Type& neighbours(unsigned i) const { return _neighbours.at(i); }
     State_Neighbours_Type& neighbours(unsigned i) { return _neighbours.at(i); }
 
+    // fixed-shape SoA view, recomputed by update_fields()
+    const Fixed_Shape_Transitions_Type& fixed_shape() const { return _fixed_shape; }
+
     // update fields from_v, p_rest_from, p_rest_to based on to_v
     void update_fields()
     {
@@ -84,7 +268,7 @@ public:
         }
         for (unsigned i = 0; i < n_states; ++i)
         {
-            logsum::logsumset< Float_Type > s(false);
+            Log_Sum_Exp< Float_Type > s;
             for (const auto& p : neighbours(i).to_v)
             {
                 neighbours(p.first).from_v.push_back(std::make_pair(i, p.second));
@@ -94,13 +278,14 @@ public:
         }
         for (unsigned i = 0; i < n_states; ++i)
         {
-            logsum::logsumset< Float_Type > s(false);
+            Log_Sum_Exp< Float_Type > s;
             for (const auto& p : neighbours(i).from_v)
             {
                 s.add(p.second);
             }
             neighbours(i).p_rest_from = std::log(1 - std::exp(s.val()));
         }
+        _fixed_shape.init(_neighbours);
     }
 
     // drop transitions with low probability
@@ -253,6 +438,7 @@ public:
 
 private:
     std::vector< State_Neighbours_Type > _neighbours;
+    Fixed_Shape_Transitions_Type _fixed_shape;
 }; // class State_Transitions
 
 #endif
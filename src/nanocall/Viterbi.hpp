@@ -1,13 +1,22 @@
 #ifndef __VITERBI_HPP
 #define __VITERBI_HPP
 
+#include <algorithm>
+#include <array>
 #include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <functional>
 #include <iostream>
+#include <limits>
 #include <vector>
 #include <set>
 
 #include "Pore_Model.hpp"
 #include "State_Transitions.hpp"
+#include "DP_Arena.hpp"
+#include "simd_support.hpp"
+#include "thread_support.hpp"
 #include "logsumset.hpp"
 #include "logger.hpp"
 #include "fast5.hpp"
@@ -22,123 +31,782 @@ public:
     typedef Event< Float_Type, Kmer_Size > Event_Type;
     typedef Event_Sequence< Float_Type, Kmer_Size > Event_Sequence_Type;
     typedef logsum::logsumset< Float_Type > LogSumSet_Type;
-
-    struct Matrix_Entry
-    {
-        Float_Type alpha; // := Pr[ MLSS producing e_1 ... e_i, with S_i == j ]
-        unsigned beta;    // := previous state in the MLSS
-    }; // struct Matrix_Entry
+    typedef typename State_Transitions_Type::Fixed_Shape_Transitions_Type Fixed_Shape_Transitions_Type;
+    typedef simd::Vec< Float_Type > Vec_Type;
+    typedef simd::Scalar_Vec< Float_Type > Scalar_Vec_Type;
 
     static const unsigned n_states = Pore_Model_Type::n_states;
+    // index of the previous state in the predecessor list of the current state:
+    // a Fixed_Shape_Transitions slot, or an index into State_Neighbours::from_v
+    typedef uint8_t Traceback_Type;
+
+    // beam search modes:
+    //   fixed_beam: keep the beam_width() best states of each column
+    //   threshold_beam: keep the states within beam_threshold() of the best state
+    //   adaptive_beam: like fixed_beam, but the width grows by beam_width() (up to beam_max_width())
+    //     whenever the best state is not reached from the previous best state,
+    //     and is halved (down to beam_width()) while the best path is stable
+    enum Beam_Mode { no_beam, fixed_beam, threshold_beam, adaptive_beam };
 
     unsigned n_events() const { return _n_events; }
     Float_Type path_probability() const { return _path_probability; }
+    // number of cells kept (resp. dropped) by the beam, over all events
+    unsigned long n_expanded() const { return _n_expanded; }
+    unsigned long n_pruned() const { return _n_pruned; }
 
     // i: event index
     // j: state/kmer index
-    const Matrix_Entry& cell(unsigned i, unsigned j) const { return _m[i * n_states + j]; }
-    Matrix_Entry& cell(unsigned i, unsigned j) { return _m[i * n_states + j]; }
+    // alpha := Pr[ MLSS producing e_1 ... e_i, with S_i == j ]; only kept for all events with full_matrix()
+    // traceback := previous state in the MLSS, as an index in the predecessor list of j;
+    //   with checkpointing, only kept for the last recomputed segment
+    // scores are stored SoA, one contiguous column of n_states values per event
+    Float_Type alpha(unsigned i, unsigned j) const { assert(_full_matrix); return _alpha[i * n_states + j]; }
+    unsigned traceback(unsigned i, unsigned j) const
+    {
+        assert(has_traceback(i));
+        return _traceback[(i - _traceback_begin) * n_states + j];
+    }
+    bool has_traceback(unsigned i) const
+    {
+        return i >= _traceback_begin and (i - _traceback_begin) * n_states < _traceback.size();
+    }
 
+    // sequences with at least parallel_min_events() events are filled by a team of up to n_threads() threads,
+    // each handling a range of states of every column; 0 disables this; the team only grows
+    // with threads left idle by the outer pool (see Spare_Threads)
     static unsigned& n_threads() { static unsigned _n_threads = 1; return _n_threads; }
+    static unsigned& parallel_min_events() { static unsigned _parallel_min_events = 20000; return _parallel_min_events; }
 
+    // if set, keep the scores of all events; by default, only 2 rolling rows are kept,
+    // and memory is dominated by the traceback (1 byte per cell)
+    static bool& full_matrix() { static bool _full_matrix = false; return _full_matrix; }
+
+    // sequences with at least this many events are filled with checkpointing: score columns
+    // are saved every checkpoint_interval() events during the forward pass, and the traceback
+    // is recomputed one segment at a time from them; this costs a second forward pass,
+    // but memory becomes O(sqrt(n)) instead of O(n); 0 disables checkpointing
+    static unsigned& checkpoint_min_events() { static unsigned _checkpoint_min_events = 50000; return _checkpoint_min_events; }
+    // events between checkpoints; 0: square root of the number of events
+    static unsigned& checkpoint_interval() { static unsigned _checkpoint_interval = 0; return _checkpoint_interval; }
+
+    // beam search trades accuracy for speed: only the states kept in the beam are expanded
+    // into the next column; requires transitions with the fixed shape
+    static Beam_Mode& beam_mode() { static Beam_Mode _beam_mode = no_beam; return _beam_mode; }
+    static unsigned& beam_width() { static unsigned _beam_width = 64; return _beam_width; }
+    static unsigned& beam_max_width() { static unsigned _beam_max_width = 1024; return _beam_max_width; }
+    static Float_Type& beam_threshold() { static Float_Type _beam_threshold = 10.0; return _beam_threshold; }
+
+    // max_threads: bound on the team size, e.g. 1 for fills already running in a team
     void fill(const Pore_Model_Type& pm,
               const State_Transitions_Type& st,
-              Event_Sequence_Type& ev)
+              Event_Sequence_Type& ev,
+              unsigned max_threads = n_threads())
     {
         _n_events = ev.size();
-        _m.clear();
-        _m.resize(n_states * n_events());
-        Float_Type log_n_states = std::log(static_cast< Float_Type >(n_states));
-        //
-        // alpha, beta; i == 0
-        //
+        _full_matrix = full_matrix();
+        _checkpoint_interval = 0;
+        if (not _full_matrix and checkpoint_min_events() > 0 and n_events() >= checkpoint_min_events())
         {
-            LOG("Viterbi", debug1) << "forward: i=0" << std::endl;
-            for (unsigned j = 0; j < n_states; ++j)
-            {
-                // alpha
-                cell(0, j).alpha = pm.log_pr_corrected_emission(j, ev[0]) - log_n_states;
-                // beta
-                cell(0, j).beta = n_states;
-                LOG("Viterbi", debug2)
-                    << "i=0 j=" << Kmer_Type::to_string(j)
-                    << " alpha=" << cell(0, j).alpha
-                    << " beta=" << cell(0, j).beta << std::endl;
-            }
+            _checkpoint_interval = (checkpoint_interval() > 0
+                                    ? checkpoint_interval()
+                                    : static_cast< unsigned >(std::ceil(std::sqrt(n_events()))));
         }
-        //
-        // alpha, beta; i > 0
-        //
-        for (unsigned i = 1; i < n_events(); ++i)
+        _engine = select_engine(st);
+        _beam = beam_mode();
+        if (_beam != no_beam and _engine == generic_engine)
         {
-            LOG("Viterbi", debug1) << "forward: i=" << i << std::endl;
-            for (unsigned j = 0; j < n_states; ++j) // TODO: parallelize
-            {
-                cell(i, j).alpha = -INFINITY;
-                cell(i, j).beta = n_states;
-                for (const auto& p : st.neighbours(j).from_v)
+            LOG("Viterbi", warning) << "beam search requires transitions with the fixed shape: disabled" << std::endl;
+            _beam = no_beam;
+        }
+        _beam_width = beam_width();
+        _beam_touched[0].clear();
+        _beam_touched[1].clear();
+        _n_expanded = 0;
+        _n_pruned = 0;
+        // the team only takes threads left idle by the outer pool, for the whole fill
+        Spare_Threads::Loan loan(_beam == no_beam and parallel_min_events() > 0 and n_events() >= parallel_min_events()
+                                 ? std::max(std::min(n_threads(), max_threads), 1u) - 1 : 0);
+        _n_threads = 1 + loan.size();
+        _alpha.clear();
+        _alpha.resize(n_states * (_full_matrix? n_events() : 2), -INFINITY);
+        _traceback.clear();
+        _traceback.resize(n_states * (_checkpoint_interval > 0? _checkpoint_interval : n_events()));
+        _traceback_begin = 0;
+        _checkpoint.clear();
+        _checkpoint.resize(_checkpoint_interval > 0? n_states * ((n_events() - 1) / _checkpoint_interval + 1) : 0);
+        _checkpoint_beam_width.clear();
+        _checkpoint_beam_width.resize(_checkpoint_interval > 0? (n_events() - 1) / _checkpoint_interval + 1 : 0);
+        init_buffers();
+        fill_first_column(pm, ev[0]);
+        Thread_Team team(_n_threads);
+        if (_checkpoint_interval == 0)
+        {
+            team.run([&] (unsigned tid) { fill_columns(pm, st, ev, 1, n_events(), true, team, tid); });
+            fill_last_state(ev);
+            fill_state_seq(st, ev, n_events() - 1, 0);
+        }
+        else
+        {
+            const unsigned& l = _checkpoint_interval;
+            LOG("Viterbi", debug) << "checkpointing: n_events=" << n_events() << " interval=" << l << std::endl;
+            std::copy(alpha_row(0), alpha_row(0) + n_states, &_checkpoint[0]);
+            _checkpoint_beam_width[0] = _beam_width;
+            unsigned long n_expanded = 0;
+            unsigned long n_pruned = 0;
+            // the steps between column ranges run on thread 0, the others waiting at the next barrier
+            team.run([&] (unsigned tid) {
+                //
+                // forward pass: save checkpoints, discard traceback
+                //
+                fill_columns(pm, st, ev, 1, n_events(), false, team, tid);
+                if (tid == 0)
                 {
-                    const unsigned& j_prev = p.first;
-                    const Float_Type& log_pr_transition = p.second;
-                    Float_Type v = log_pr_transition + cell(i - 1, j_prev).alpha;
-                    if (v > cell(i, j).alpha)
+                    fill_last_state(ev);
+                    n_expanded = _n_expanded;
+                    n_pruned = _n_pruned;
+                }
+                //
+                // backward pass: recompute traceback of segment (k * l, min((k + 1) * l, n_events - 1)]
+                //
+                for (unsigned k = (n_events() - 1) / l + 1; k-- > 0; )
+                {
+                    unsigned i_begin = k * l;
+                    unsigned i_end = std::min(i_begin + l, n_events() - 1);
+                    if (i_end == i_begin) continue;
+                    if (tid == 0)
+                    {
+                        _traceback_begin = i_begin + 1;
+                        std::copy(&_checkpoint[k * n_states], &_checkpoint[(k + 1) * n_states], alpha_row(i_begin));
+                        if (_beam != no_beam)
+                        {
+                            beam_restore(i_begin, _checkpoint_beam_width[k]);
+                        }
+                    }
+                    if (_n_threads > 1) team.barrier();
+                    fill_columns(pm, st, ev, i_begin + 1, i_end + 1, true, team, tid);
+                    if (tid == 0)
                     {
-                        cell(i, j).alpha = v;
-                        cell(i, j).beta = j_prev;
+                        fill_state_seq(st, ev, i_end, i_begin);
                     }
                 }
-                cell(i, j).alpha += pm.log_pr_corrected_emission(j, ev[i]);
-                LOG("Viterbi", debug2)
-                    << "i=" << i << " j=" << Kmer_Type::to_string(j)
-                    << " alpha=" << cell(i, j).alpha
-                    << " beta=" << cell(i, j).beta << std::endl;
-            }
+            });
+            _n_expanded = n_expanded;
+            _n_pruned = n_pruned;
+        }
+        if (_beam == no_beam)
+        {
+            _n_expanded = static_cast< unsigned long >(n_states) * n_events();
         }
-        fill_state_seq(ev);
         fill_move_seq(ev);
     }
 
+    //
+    // incremental interface, for decoders that consume events one at a time:
+    // begin() with the first event, then extend() with each following event;
+    // the caller keeps the traceback rows it needs (n_states values per event),
+    // and follows them with predecessor(); beam search and threads are not used
+    //
+    void begin(const Pore_Model_Type& pm, const State_Transitions_Type& st, const Event_Type& e)
+    {
+        _n_events = 1;
+        _full_matrix = false;
+        _checkpoint_interval = 0;
+        _engine = select_engine(st);
+        _beam = no_beam;
+        _n_threads = 1;
+        _alpha.assign(2 * n_states, -INFINITY);
+        _traceback.assign(n_states, 0);
+        _traceback_begin = 0;
+        init_buffers();
+        fill_first_column(pm, e);
+    }
+
+    // fill the column of event e; if traceback_crt is null, the traceback is discarded
+    void extend(const Pore_Model_Type& pm, const State_Transitions_Type& st, const Event_Type& e,
+                Traceback_Type* traceback_crt)
+    {
+        unsigned i = _n_events++;
+        fill_column(pm, st, e, i, alpha_row(i - 1), alpha_row(i),
+                    traceback_crt? traceback_crt : &_traceback[0],
+                    0, n_states, _buffers[0]);
+    }
+
+    // scores of the last event filled; may be modified to constrain the path
+    Float_Type* last_column() { return alpha_row(_n_events - 1); }
+    const Float_Type* last_column() const { return &_alpha[((_n_events - 1) % 2) * n_states]; }
+
+    // state preceding j, given the traceback value s of j
+    unsigned predecessor(const State_Transitions_Type& st, unsigned s, unsigned j) const
+    {
+        return prev_state(st, s, j);
+    }
+
+    // log probability of the state path stored in ev, as scored by fill();
+    // transitions missing from st are not counted
+    static Float_Type path_score(const Pore_Model_Type& pm,
+                                 const State_Transitions_Type& st,
+                                 const Event_Sequence_Type& ev)
+    {
+        Float_Type res = pm.log_pr_corrected_emission(ev[0].model_state_idx, ev[0])
+            - std::log(static_cast< Float_Type >(n_states));
+        for (unsigned i = 1; i < ev.size(); ++i)
+        {
+            unsigned j_prev = ev[i - 1].model_state_idx;
+            unsigned j = ev[i].model_state_idx;
+            for (const auto& p : st.neighbours(j).from_v)
+            {
+                if (p.first == j_prev)
+                {
+                    res += p.second;
+                    break;
+                }
+            }
+            res += pm.log_pr_corrected_emission(j, ev[i]);
+        }
+        return res;
+    }
+
     friend std::ostream& operator << (std::ostream& os, const Viterbi& vit)
     {
         for (unsigned i = 0; i < vit.n_events(); ++i)
         {
+            if (not vit._full_matrix and not vit.has_traceback(i)) continue;
             for (unsigned j = 0; j < vit.n_states; ++j)
             {
-                os << i << '\t' << j << '\t'
-                   << vit.cell(i, j).alpha << '\t'
-                   << vit.cell(i, j).beta << std::endl;
+                os << i << '\t' << j;
+                if (vit._full_matrix)
+                {
+                    os << '\t' << vit.alpha(i, j);
+                }
+                if (vit.has_traceback(i))
+                {
+                    os << '\t' << vit.traceback(i, j);
+                }
+                os << std::endl;
             }
         }
         return os;
     }
 
 private:
-    std::vector< Matrix_Entry > _m;
+    enum Engine { generic_engine, fixed_shape_engine, grouped_engine };
+
+    DP_Arena_Vector< Float_Type > _alpha;
+    DP_Arena_Vector< Traceback_Type > _traceback;
+    DP_Arena_Vector< Float_Type > _checkpoint;
+    std::vector< unsigned > _checkpoint_beam_width;
+    // beam: states written in the column with the same parity, to reset before reuse
+    std::array< std::vector< unsigned >, 2 > _beam_touched;
+    // beam: states kept in the last column, in increasing order
+    std::vector< unsigned > _beam_active;
+    std::vector< Float_Type > _beam_buf;
+    // per-thread scratch space of the column kernels
+    struct Column_Buffers
+    {
+        std::vector< Float_Type > group_max;
+        std::vector< Float_Type > group_slot;
+    };
+
+    std::vector< Float_Type > _emission;
+    std::vector< Column_Buffers > _buffers;
     Float_Type _path_probability;
     unsigned _n_events;
+    unsigned _n_threads;
+    unsigned _traceback_begin;
+    unsigned _checkpoint_interval;
+    unsigned _beam_width;
+    unsigned _beam_best;
+    unsigned long _n_expanded;
+    unsigned long _n_pruned;
+    bool _full_matrix;
+    Engine _engine;
+    Beam_Mode _beam;
 
-    void fill_state_seq(Event_Sequence_Type& ev)
+    Float_Type* alpha_row(unsigned i) { return &_alpha[(_full_matrix? i : i % 2) * n_states]; }
+    Traceback_Type* traceback_row(unsigned i) { return &_traceback[(i - _traceback_begin) * n_states]; }
+
+    static Engine select_engine(const State_Transitions_Type& st)
+    {
+        if (st.fixed_shape().grouped) return grouped_engine;
+        if (st.fixed_shape().valid) return fixed_shape_engine;
+        for (unsigned j = 0; j < n_states; ++j)
+        {
+            if (st.neighbours(j).from_v.size() > std::numeric_limits< Traceback_Type >::max() + 1u)
+            {
+                LOG(error)
+                    << "too many predecessors for state [" << Kmer_Type::to_string(j) << "]" << std::endl;
+                std::exit(EXIT_FAILURE);
+            }
+        }
+        return generic_engine;
+    }
+
+    // state reached from j by following traceback value s
+    unsigned prev_state(const State_Transitions_Type& st, unsigned s, unsigned j) const
+    {
+        return (_engine == generic_engine
+                ? st.neighbours(j).from_v[s].first
+                : Fixed_Shape_Transitions_Type::pred(s, j));
+    }
+
+    void init_buffers()
+    {
+        _emission.resize(n_states);
+        _buffers.resize(_n_threads);
+        for (auto& b : _buffers)
+        {
+            b.group_max.resize(Fixed_Shape_Transitions_Type::n_step_groups + Fixed_Shape_Transitions_Type::n_skip_groups);
+            b.group_slot.resize(b.group_max.size());
+        }
+    }
+
+    void fill_first_column(const Pore_Model_Type& pm, const Event_Type& e)
+    {
+        LOG("Viterbi", debug1) << "forward: i=0" << std::endl;
+        Float_Type log_n_states = std::log(static_cast< Float_Type >(n_states));
+        Float_Type* alpha_crt = alpha_row(0);
+        pm.fill_corrected_emissions(e, alpha_crt);
+        for (unsigned j = 0; j < n_states; ++j)
+        {
+            alpha_crt[j] -= log_n_states;
+            LOG("Viterbi", debug2)
+                << "i=0 j=" << Kmer_Type::to_string(j)
+                << " alpha=" << alpha_crt[j] << std::endl;
+        }
+        if (_beam != no_beam)
+        {
+            auto& touched = _beam_touched[0];
+            touched.resize(n_states);
+            for (unsigned j = 0; j < n_states; ++j)
+            {
+                touched[j] = j;
+            }
+            beam_prune(alpha_crt, touched, nullptr);
+        }
+    }
+
+    // fill columns [i_begin, i_end) as thread tid of team; states are split in ranges of whole
+    // 16-state blocks, and a barrier after each column makes it visible to all threads;
+    // if keep_traceback is not set, the traceback is discarded, and checkpoints are saved instead
+    void fill_columns(const Pore_Model_Type& pm, const State_Transitions_Type& st, const Event_Sequence_Type& ev,
+                      unsigned i_begin, unsigned i_end, bool keep_traceback, Thread_Team& team, unsigned tid)
+    {
+        static const unsigned n_blocks = n_states / 16;
+        unsigned j_begin = (n_blocks * tid / _n_threads) * 16;
+        unsigned j_end = (n_blocks * (tid + 1) / _n_threads) * 16;
+        const unsigned& l = _checkpoint_interval;
+        for (unsigned i = i_begin; i < i_end; ++i)
+        {
+            fill_column(pm, st, ev[i], i, alpha_row(i - 1), alpha_row(i),
+                        keep_traceback? traceback_row(i) : &_traceback[0],
+                        j_begin, j_end, _buffers[tid]);
+            if (not keep_traceback and l > 0 and i % l == 0)
+            {
+                std::copy(alpha_row(i) + j_begin, alpha_row(i) + j_end, &_checkpoint[(i / l) * n_states + j_begin]);
+                if (tid == 0)
+                {
+                    _checkpoint_beam_width[i / l] = _beam_width;
+                }
+            }
+            if (_n_threads > 1) team.barrier();
+        }
+    }
+
+    // fill states [j_begin, j_end) of column i
+    void fill_column(const Pore_Model_Type& pm, const State_Transitions_Type& st, const Event_Type& e,
+                     unsigned i, const Float_Type* alpha_prev, Float_Type* alpha_crt, Traceback_Type* traceback_crt,
+                     unsigned j_begin, unsigned j_end, Column_Buffers& buffers)
+    {
+        if (j_begin == 0)
+        {
+            LOG("Viterbi", debug1) << "forward: i=" << i << std::endl;
+        }
+        if (_beam != no_beam)
+        {
+            auto& touched = _beam_touched[i % 2];
+            fill_column_beam(pm, st.fixed_shape(), e, alpha_prev, alpha_crt, traceback_crt, touched);
+            beam_prune(alpha_crt, touched, traceback_crt);
+            return;
+        }
+        pm.fill_corrected_emissions(e, &_emission[0], j_begin, j_end);
+        switch (_engine)
+        {
+        case grouped_engine:
+            fill_column_grouped(st.fixed_shape(), alpha_prev, alpha_crt, traceback_crt, j_begin, j_end, buffers);
+            break;
+        case fixed_shape_engine:
+            fill_column_fixed_shape(st.fixed_shape(), alpha_prev, alpha_crt, traceback_crt, j_begin, j_end);
+            break;
+        default:
+            fill_column_generic(st, alpha_prev, alpha_crt, traceback_crt, j_begin, j_end);
+        }
+        for (unsigned j = j_begin; j < j_end; ++j)
+        {
+            LOG("Viterbi", debug2)
+                << "i=" << i << " j=" << Kmer_Type::to_string(j)
+                << " alpha=" << alpha_crt[j]
+                << " prev=" << Kmer_Type::to_string(prev_state(st, traceback_crt[j], j)) << std::endl;
+        }
+    }
+
+    // column using the generic predecessor lists
+    void fill_column_generic(const State_Transitions_Type& st,
+                             const Float_Type* alpha_prev, Float_Type* alpha_crt, Traceback_Type* traceback_crt,
+                             unsigned j_begin, unsigned j_end)
+    {
+        for (unsigned j = j_begin; j < j_end; ++j)
+        {
+            const auto& from_v = st.neighbours(j).from_v;
+            Float_Type best_v = -INFINITY;
+            unsigned best_s = 0;
+            for (unsigned s = 0; s < from_v.size(); ++s)
+            {
+                const unsigned& j_prev = from_v[s].first;
+                const Float_Type& log_pr_transition = from_v[s].second;
+                Float_Type v = log_pr_transition + alpha_prev[j_prev];
+                if (v > best_v)
+                {
+                    best_v = v;
+                    best_s = s;
+                }
+            }
+            alpha_crt[j] = best_v + _emission[j];
+            traceback_crt[j] = best_s;
+        }
+    }
+
+    // column using the fixed transition shape; states are processed in blocks of 16
+    // sharing the same skip predecessors, with all 21 slots evaluated in SIMD lanes
+    void fill_column_fixed_shape(const Fixed_Shape_Transitions_Type& fst,
+                                 const Float_Type* alpha_prev, Float_Type* alpha_crt, Traceback_Type* traceback_crt,
+                                 unsigned j_begin, unsigned j_end)
+    {
+        static const unsigned block_size = 16;
+        static const unsigned n_lanes = Vec_Type::width;
+        static_assert(block_size % n_lanes == 0, "block size must be a multiple of SIMD width");
+        Float_Type step_v[4][block_size];
+        Float_Type slot_v[block_size];
+        for (unsigned j0 = j_begin; j0 < j_end; j0 += block_size)
+        {
+            // expand step predecessor scores: 4 consecutive states share each one
+            for (unsigned b = 0; b < 4; ++b)
+            {
+                const Float_Type* p = alpha_prev + Fixed_Shape_Transitions_Type::pred(1 + b, j0);
+                for (unsigned k = 0; k < block_size; ++k)
+                {
+                    step_v[b][k] = p[k >> 2];
+                }
+            }
+            for (unsigned k = 0; k < block_size; k += n_lanes)
+            {
+                unsigned j = j0 + k;
+                // stay
+                auto best = Vec_Type::add(Vec_Type::load(alpha_prev + j), Vec_Type::load(fst.log_pr_slot(0) + j));
+                auto best_s = Vec_Type::set1(0);
+                // step
+                for (unsigned b = 0; b < 4; ++b)
+                {
+                    auto v = Vec_Type::add(Vec_Type::load(&step_v[b][k]), Vec_Type::load(fst.log_pr_slot(1 + b) + j));
+                    auto m = Vec_Type::gt(v, best);
+                    best = Vec_Type::max(v, best);
+                    best_s = Vec_Type::blend(m, Vec_Type::set1(1 + b), best_s);
+                }
+                // skip: all states in the block share these predecessors
+                for (unsigned s = 5; s < Fixed_Shape_Transitions_Type::n_slots; ++s)
+                {
+                    auto v = Vec_Type::add(Vec_Type::set1(alpha_prev[Fixed_Shape_Transitions_Type::pred(s, j0)]),
+                                           Vec_Type::load(fst.log_pr_slot(s) + j));
+                    auto m = Vec_Type::gt(v, best);
+                    best = Vec_Type::max(v, best);
+                    best_s = Vec_Type::blend(m, Vec_Type::set1(s), best_s);
+                }
+                Vec_Type::store(alpha_crt + j, Vec_Type::add(best, Vec_Type::load(&_emission[j])));
+                Vec_Type::store(&slot_v[k], best_s);
+            }
+            for (unsigned k = 0; k < block_size; ++k)
+            {
+                traceback_crt[j0 + k] = static_cast< Traceback_Type >(slot_v[k]);
+            }
+        }
+    }
+
+    // step groups: max over the 4 states b * 4^(Kmer_Size-1) + q, for q in [q_begin, q_end);
+    // the argmax is recorded as step slot 1 + b
+    template < typename V >
+    static void step_group_max(const Float_Type* alpha_prev, Float_Type* m, Float_Type* m_slot,
+                               unsigned q_begin, unsigned q_end)
+    {
+        static const unsigned stride = Fixed_Shape_Transitions_Type::n_step_groups;
+        for (unsigned q = q_begin; q < q_end; q += V::width)
+        {
+            auto best = V::load(alpha_prev + q);
+            auto best_s = V::set1(1);
+            for (unsigned b = 1; b < 4; ++b)
+            {
+                auto v = V::load(alpha_prev + b * stride + q);
+                auto msk = V::gt(v, best);
+                best = V::max(v, best);
+                best_s = V::blend(msk, V::set1(1 + b), best_s);
+            }
+            V::store(m + q, best);
+            V::store(m_slot + q, best_s);
+        }
+    }
+
+    // skip groups: max over the 4 step groups b2 * 4^(Kmer_Size-2) + r, for r in [r_begin, r_end);
+    // step slot 1 + b1 of step group b2 * 4^(Kmer_Size-2) + r is skip slot 5 + 4 * b1 + b2
+    template < typename V >
+    static void skip_group_max(const Float_Type* step_m, const Float_Type* step_m_slot,
+                               Float_Type* m, Float_Type* m_slot,
+                               unsigned r_begin, unsigned r_end)
+    {
+        static const unsigned stride = Fixed_Shape_Transitions_Type::n_skip_groups;
+        for (unsigned r = r_begin; r < r_end; r += V::width)
+        {
+            auto best = V::load(step_m + r);
+            auto best_s = V::add(V::mul(V::load(step_m_slot + r), V::set1(4)), V::set1(1));
+            for (unsigned b2 = 1; b2 < 4; ++b2)
+            {
+                auto v = V::load(step_m + b2 * stride + r);
+                auto msk = V::gt(v, best);
+                best = V::max(v, best);
+                best_s = V::blend(msk,
+                                  V::add(V::mul(V::load(step_m_slot + b2 * stride + r), V::set1(4)), V::set1(1 + b2)),
+                                  best_s);
+            }
+            V::store(m + r, best);
+            V::store(m_slot + r, best_s);
+        }
+    }
+
+    // column using the grouped recursion: the max over the step (resp. skip) predecessors
+    // is computed once per group, and shared by the 4 (resp. 16) regular states using it;
+    // irregular states are redone with all 21 slots;
+    // group maxima are computed in full, so that threads filling different ranges need no extra barrier
+    void fill_column_grouped(const Fixed_Shape_Transitions_Type& fst,
+                             const Float_Type* alpha_prev, Float_Type* alpha_crt, Traceback_Type* traceback_crt,
+                             unsigned j_begin, unsigned j_end, Column_Buffers& buffers)
+    {
+        static const unsigned block_size = 16;
+        static const unsigned n_lanes = Vec_Type::width;
+        static const unsigned n_step_groups = Fixed_Shape_Transitions_Type::n_step_groups;
+        static const unsigned n_skip_groups = Fixed_Shape_Transitions_Type::n_skip_groups;
+        static_assert(block_size % n_lanes == 0, "block size must be a multiple of SIMD width");
+        Float_Type* step_m = &buffers.group_max[0];
+        Float_Type* step_m_slot = &buffers.group_slot[0];
+        Float_Type* skip_m = &buffers.group_max[n_step_groups];
+        Float_Type* skip_m_slot = &buffers.group_slot[n_step_groups];
+        unsigned q_end = n_step_groups - n_step_groups % n_lanes;
+        step_group_max< Vec_Type >(alpha_prev, step_m, step_m_slot, 0, q_end);
+        step_group_max< Scalar_Vec_Type >(alpha_prev, step_m, step_m_slot, q_end, n_step_groups);
+        unsigned r_end = n_skip_groups - n_skip_groups % n_lanes;
+        skip_group_max< Vec_Type >(step_m, step_m_slot, skip_m, skip_m_slot, 0, r_end);
+        skip_group_max< Scalar_Vec_Type >(step_m, step_m_slot, skip_m, skip_m_slot, r_end, n_skip_groups);
+        Float_Type step_v[block_size];
+        Float_Type step_s[block_size];
+        Float_Type slot_v[block_size];
+        for (unsigned j0 = j_begin; j0 < j_end; j0 += block_size)
+        {
+            // 4 consecutive states share each step group, all states in the block share the skip group
+            for (unsigned k = 0; k < block_size; ++k)
+            {
+                step_v[k] = step_m[(j0 + k) >> 2];
+                step_s[k] = step_m_slot[(j0 + k) >> 2];
+            }
+            auto skip_v = Vec_Type::set1(skip_m[j0 >> 4]);
+            auto skip_s = Vec_Type::set1(skip_m_slot[j0 >> 4]);
+            for (unsigned k = 0; k < block_size; k += n_lanes)
+            {
+                unsigned j = j0 + k;
+                auto best = Vec_Type::add(Vec_Type::load(alpha_prev + j), Vec_Type::load(fst.log_pr_group_slice(0) + j));
+                auto best_s = Vec_Type::set1(0);
+                auto v = Vec_Type::add(Vec_Type::load(&step_v[k]), Vec_Type::load(fst.log_pr_group_slice(1) + j));
+                auto msk = Vec_Type::gt(v, best);
+                best = Vec_Type::max(v, best);
+                best_s = Vec_Type::blend(msk, Vec_Type::load(&step_s[k]), best_s);
+                v = Vec_Type::add(skip_v, Vec_Type::load(fst.log_pr_group_slice(2) + j));
+                msk = Vec_Type::gt(v, best);
+                best = Vec_Type::max(v, best);
+                best_s = Vec_Type::blend(msk, skip_s, best_s);
+                Vec_Type::store(alpha_crt + j, Vec_Type::add(best, Vec_Type::load(&_emission[j])));
+                Vec_Type::store(&slot_v[k], best_s);
+            }
+            for (unsigned k = 0; k < block_size; ++k)
+            {
+                traceback_crt[j0 + k] = static_cast< Traceback_Type >(slot_v[k]);
+            }
+        }
+        for (auto j : fst.irregular_v)
+        {
+            if (j < j_begin or j >= j_end) continue;
+            Float_Type best_v = -INFINITY;
+            unsigned best_s = 0;
+            for (unsigned s = 0; s < Fixed_Shape_Transitions_Type::n_slots; ++s)
+            {
+                Float_Type v = fst.log_pr(s, j) + alpha_prev[Fixed_Shape_Transitions_Type::pred(s, j)];
+                if (v > best_v)
+                {
+                    best_v = v;
+                    best_s = s;
+                }
+            }
+            alpha_crt[j] = best_v + _emission[j];
+            traceback_crt[j] = best_s;
+        }
+    }
+
+    // column using beam search: the states kept in the previous column push their scores
+    // to their successors; emissions are only computed for the states reached
+    void fill_column_beam(const Pore_Model_Type& pm, const Fixed_Shape_Transitions_Type& fst, const Event_Type& e,
+                          const Float_Type* alpha_prev, Float_Type* alpha_crt, Traceback_Type* traceback_crt,
+                          std::vector< unsigned >& touched)
+    {
+        static const unsigned mask = n_states - 1;
+        for (auto j : touched)
+        {
+            alpha_crt[j] = -INFINITY;
+        }
+        touched.clear();
+        auto relax = [&] (unsigned j, unsigned s, Float_Type v) {
+            if (not (v > alpha_crt[j])) return;
+            if (alpha_crt[j] == -INFINITY) touched.push_back(j);
+            alpha_crt[j] = v;
+            traceback_crt[j] = s;
+        };
+        for (auto j_prev : _beam_active)
+        {
+            Float_Type v = alpha_prev[j_prev];
+            // stay
+            relax(j_prev, 0, v + fst.log_pr(0, j_prev));
+            // step: j_prev is the step predecessor in slot 1 + (first base of j_prev)
+            unsigned s = 1 + (j_prev >> (2 * (Kmer_Size - 1)));
+            unsigned j0 = (j_prev << 2) & mask;
+            for (unsigned c = 0; c < 4; ++c)
+            {
+                relax(j0 + c, s, v + fst.log_pr(s, j0 + c));
+            }
+            // skip: j_prev is the skip predecessor in slot 5 + (first 2 bases of j_prev)
+            s = 5 + (j_prev >> (2 * (Kmer_Size - 2)));
+            j0 = (j_prev << 4) & mask;
+            for (unsigned c = 0; c < 16; ++c)
+            {
+                relax(j0 + c, s, v + fst.log_pr(s, j0 + c));
+            }
+        }
+        for (auto j : touched)
+        {
+            alpha_crt[j] += pm.log_pr_corrected_emission(j, e);
+        }
+    }
+
+    // drop the states of the current column outside the beam;
+    // the states kept are saved in _beam_active, in increasing order
+    void beam_prune(Float_Type* alpha_crt, const std::vector< unsigned >& touched, const Traceback_Type* traceback_crt)
+    {
+        Float_Type best_v = -INFINITY;
+        unsigned best_j = 0;
+        for (auto j : touched)
+        {
+            if (alpha_crt[j] > best_v or (alpha_crt[j] == best_v and j < best_j))
+            {
+                best_v = alpha_crt[j];
+                best_j = j;
+            }
+        }
+        if (_beam == adaptive_beam and traceback_crt)
+        {
+            if (Fixed_Shape_Transitions_Type::pred(traceback_crt[best_j], best_j) != _beam_best)
+            {
+                _beam_width = std::min(_beam_width + beam_width(), std::max(beam_max_width(), beam_width()));
+            }
+            else
+            {
+                _beam_width = std::max(_beam_width / 2, beam_width());
+            }
+        }
+        _beam_best = best_j;
+        Float_Type cutoff = -INFINITY;
+        if (_beam == threshold_beam)
+        {
+            cutoff = best_v - beam_threshold();
+        }
+        else if (touched.size() > _beam_width)
+        {
+            _beam_buf.clear();
+            for (auto j : touched)
+            {
+                _beam_buf.push_back(alpha_crt[j]);
+            }
+            std::nth_element(_beam_buf.begin(), _beam_buf.begin() + (_beam_width - 1), _beam_buf.end(),
+                             std::greater< Float_Type >());
+            cutoff = _beam_buf[_beam_width - 1];
+        }
+        _beam_active.clear();
+        for (auto j : touched)
+        {
+            if (alpha_crt[j] > -INFINITY and alpha_crt[j] >= cutoff)
+            {
+                _beam_active.push_back(j);
+            }
+            else
+            {
+                alpha_crt[j] = -INFINITY;
+            }
+        }
+        std::sort(_beam_active.begin(), _beam_active.end());
+        _n_expanded += _beam_active.size();
+        _n_pruned += n_states - _beam_active.size();
+    }
+
+    // rebuild the beam from a checkpoint column: pruned states are stored as -inf
+    void beam_restore(unsigned i, unsigned width)
+    {
+        const Float_Type* alpha_crt = alpha_row(i);
+        Float_Type* alpha_next = alpha_row(i + 1);
+        std::fill(alpha_next, alpha_next + n_states, -INFINITY);
+        _beam_touched[(i + 1) % 2].clear();
+        _beam_active.clear();
+        Float_Type best_v = -INFINITY;
+        for (unsigned j = 0; j < n_states; ++j)
+        {
+            if (alpha_crt[j] == -INFINITY) continue;
+            _beam_active.push_back(j);
+            if (alpha_crt[j] > best_v)
+            {
+                best_v = alpha_crt[j];
+                _beam_best = j;
+            }
+        }
+        _beam_touched[i % 2] = _beam_active;
+        _beam_width = width;
+    }
+
+    // pick the best state for the last event
+    void fill_last_state(Event_Sequence_Type& ev)
     {
         assert(Kmer_Size <= MAX_K_LEN);
+        const Float_Type* alpha_last = alpha_row(n_events() - 1);
         Float_Type max_v = -INFINITY;
-        unsigned max_j = n_states;
+        unsigned max_j = 0;
         for (unsigned j = 0; j < n_states; ++j)
         {
-            if (cell(n_events() - 1, j).alpha > max_v)
+            if (alpha_last[j] > max_v)
             {
                 max_j = j;
-                max_v = cell(n_events() - 1, j).alpha;
+                max_v = alpha_last[j];
             }
         }
         _path_probability = max_v;
-        for (unsigned i = n_events() - 1; i > 0; --i)
+        ev[n_events() - 1].model_state_idx = max_j;
+    }
+
+    // follow the traceback from the state of event i_end down to event i_begin
+    void fill_state_seq(const State_Transitions_Type& st, Event_Sequence_Type& ev, unsigned i_end, unsigned i_begin)
+    {
+        for (unsigned i = i_end; i > i_begin; --i)
         {
-            ev[i].model_state_idx = max_j;
-            ev[i].set_model_state(Kmer_Type::to_string(ev[i].model_state_idx));
-            max_j = cell(i, max_j).beta;
+            ev[i - 1].model_state_idx = prev_state(st, traceback(i, ev[i].model_state_idx), ev[i].model_state_idx);
         }
-        ev[0].model_state_idx = max_j;
-        ev[0].set_model_state(Kmer_Type::to_string(ev[0].model_state_idx));
     }
 
     void fill_move_seq(Event_Sequence_Type& ev)
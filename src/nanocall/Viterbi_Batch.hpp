@@ -0,0 +1,295 @@
+#ifndef __VITERBI_BATCH_HPP
+#define __VITERBI_BATCH_HPP
+
+#include <array>
+#include <cassert>
+#include <cmath>
+#include <iostream>
+#include <vector>
+
+#include "Pore_Model.hpp"
+#include "State_Transitions.hpp"
+#include "DP_Arena.hpp"
+#include "Viterbi.hpp"
+#include "simd_support.hpp"
+#include "logger.hpp"
+
+/*
+ * Viterbi over a batch of event sequences, filled in lockstep with one sequence per SIMD lane.
+ *
+ * Scores are lane-interleaved: the n_lanes values of state j are contiguous, so every step
+ * of the grouped recursion (see Viterbi::fill_column_grouped) is one vector operation
+ * covering all sequences. Each sequence has its own pore model and transitions; the grouped
+ * transition weights are interleaved the same way, and the emissions of each lane are
+ * computed by its pore model, then interleaved. Sequences of different lengths are
+ * handled by masking: a lane that runs out of events keeps going on stale data, and its
+ * result is taken at its last event. Batching pays off for short, similar-length sequences.
+ */
+template < typename Float_Type, unsigned Kmer_Size = 6 >
+class Viterbi_Batch
+{
+public:
+    typedef Kmer< Kmer_Size > Kmer_Type;
+    typedef Pore_Model< Float_Type, Kmer_Size > Pore_Model_Type;
+    typedef State_Transitions< Float_Type, Kmer_Size > State_Transitions_Type;
+    typedef Event_Sequence< Float_Type, Kmer_Size > Event_Sequence_Type;
+    typedef typename State_Transitions_Type::Fixed_Shape_Transitions_Type Fixed_Shape_Transitions_Type;
+    typedef typename Viterbi< Float_Type, Kmer_Size >::Traceback_Type Traceback_Type;
+    typedef simd::Vec< Float_Type > Vec_Type;
+
+    static const unsigned n_states = Pore_Model_Type::n_states;
+    static const unsigned n_lanes = Vec_Type::width;
+
+    // sequences using these transitions can be batched
+    static bool can_batch(const State_Transitions_Type& st) { return st.fixed_shape().grouped; }
+
+    unsigned n_seqs() const { return _n_seqs; }
+    Float_Type path_probability(unsigned k) const { return _path_probability[k]; }
+
+    // fill up to n_lanes sequences; sequence k uses pore model pm_v[k] and transitions st_v[k]
+    void fill(const std::vector< const Pore_Model_Type* >& pm_v,
+              const std::vector< const State_Transitions_Type* >& st_v,
+              const std::vector< Event_Sequence_Type* >& ev_v)
+    {
+        assert(ev_v.size() <= n_lanes);
+        assert(pm_v.size() == ev_v.size() and st_v.size() == ev_v.size());
+        _n_seqs = ev_v.size();
+        _pm_v = pm_v;
+        _st_v = st_v;
+        _n_events.assign(n_lanes, 0);
+        _path_probability.assign(_n_seqs, -INFINITY);
+        _last_state.assign(_n_seqs, 0);
+        unsigned max_events = 0;
+        for (unsigned k = 0; k < _n_seqs; ++k)
+        {
+            assert(can_batch(*st_v[k]));
+            _n_events[k] = ev_v[k]->size();
+            max_events = std::max(max_events, _n_events[k]);
+        }
+        if (max_events == 0) return;
+        LOG("Viterbi_Batch", debug) << "n_seqs=" << _n_seqs << " max_events=" << max_events << std::endl;
+        init_transitions();
+        _alpha.assign(2 * n_states * n_lanes, 0);
+        _emission.assign(n_states * n_lanes, 0);
+        _lane_emission.resize(n_states);
+        _traceback.assign(static_cast< size_t >(max_events) * n_states * n_lanes, 0);
+        _group_max.resize((Fixed_Shape_Transitions_Type::n_step_groups + Fixed_Shape_Transitions_Type::n_skip_groups) * n_lanes);
+        _group_slot.resize(_group_max.size());
+        //
+        // i == 0
+        //
+        for (unsigned k = 0; k < _n_seqs; ++k)
+        {
+            if (_n_events[k] > 0) fill_emission(k, (*ev_v[k])[0]);
+        }
+        auto log_n_states = Vec_Type::set1(std::log(static_cast< Float_Type >(n_states)));
+        for (unsigned j = 0; j < n_states; ++j)
+        {
+            Vec_Type::store(&_alpha[j * n_lanes], Vec_Type::sub(Vec_Type::load(&_emission[j * n_lanes]), log_n_states));
+        }
+        finish_lanes(0, &_alpha[0]);
+        //
+        // i > 0; lanes past their last event keep using their last event
+        //
+        for (unsigned i = 1; i < max_events; ++i)
+        {
+            for (unsigned k = 0; k < _n_seqs; ++k)
+            {
+                if (i < _n_events[k])
+                {
+                    fill_emission(k, (*ev_v[k])[i]);
+                }
+            }
+            Float_Type* alpha_crt = &_alpha[(i % 2) * n_states * n_lanes];
+            fill_column(&_alpha[((i - 1) % 2) * n_states * n_lanes], alpha_crt,
+                        &_traceback[static_cast< size_t >(i) * n_states * n_lanes]);
+            finish_lanes(i, alpha_crt);
+        }
+        for (unsigned k = 0; k < _n_seqs; ++k)
+        {
+            if (_n_events[k] == 0) continue;
+            fill_state_seq(k, *ev_v[k]);
+        }
+    }
+
+private:
+    std::vector< const Pore_Model_Type* > _pm_v;
+    std::vector< const State_Transitions_Type* > _st_v;
+    std::vector< unsigned > _n_events;
+    std::vector< Float_Type > _path_probability;
+    std::vector< unsigned > _last_state;
+    // lane-interleaved grouped transition weights, scores, emissions, and traceback
+    std::vector< Float_Type > _log_pr;
+    DP_Arena_Vector< Float_Type > _alpha;
+    DP_Arena_Vector< Float_Type > _emission;
+    // emissions of one lane, before interleaving
+    std::vector< Float_Type > _lane_emission;
+    DP_Arena_Vector< Traceback_Type > _traceback;
+    std::vector< Float_Type > _group_max;
+    std::vector< Float_Type > _group_slot;
+    // states irregular in any of the transitions
+    std::vector< unsigned > _irregular_v;
+    unsigned _n_seqs;
+
+    // emissions of event e in lane k, computed by the model of that lane (sparse if
+    // Pore_Model::sparse_emission_stdvs() is set), then interleaved; lanes without
+    // events keep their previous emissions
+    void fill_emission(unsigned k, const Event< Float_Type, Kmer_Size >& e)
+    {
+        _pm_v[k]->fill_corrected_emissions(e, &_lane_emission[0]);
+        for (unsigned j = 0; j < n_states; ++j)
+        {
+            _emission[j * n_lanes + k] = _lane_emission[j];
+        }
+    }
+
+    // empty lanes reuse the transitions of lane 0
+    void init_transitions()
+    {
+        _log_pr.resize(3 * n_states * n_lanes);
+        std::vector< bool > irregular(n_states, false);
+        for (unsigned k = 0; k < n_lanes; ++k)
+        {
+            const Fixed_Shape_Transitions_Type& fst = _st_v[k < _n_seqs? k : 0]->fixed_shape();
+            for (unsigned g = 0; g < 3; ++g)
+            {
+                const Float_Type* log_pr_slice = fst.log_pr_group_slice(g);
+                for (unsigned j = 0; j < n_states; ++j)
+                {
+                    _log_pr[(g * n_states + j) * n_lanes + k] = log_pr_slice[j];
+                }
+            }
+            for (auto j : fst.irregular_v)
+            {
+                irregular[j] = true;
+            }
+        }
+        _irregular_v.clear();
+        for (unsigned j = 0; j < n_states; ++j)
+        {
+            if (irregular[j]) _irregular_v.push_back(j);
+        }
+    }
+
+    // grouped recursion, as in Viterbi::fill_column_grouped, on lane-interleaved columns
+    void fill_column(const Float_Type* alpha_prev, Float_Type* alpha_crt, Traceback_Type* traceback_crt)
+    {
+        static const unsigned n_step_groups = Fixed_Shape_Transitions_Type::n_step_groups;
+        static const unsigned n_skip_groups = Fixed_Shape_Transitions_Type::n_skip_groups;
+        static const unsigned l = n_lanes;
+        Float_Type* step_m = &_group_max[0];
+        Float_Type* step_m_slot = &_group_slot[0];
+        Float_Type* skip_m = &_group_max[n_step_groups * l];
+        Float_Type* skip_m_slot = &_group_slot[n_step_groups * l];
+        // step groups: max over states b * 4^(Kmer_Size-1) + q, in step slot 1 + b
+        for (unsigned q = 0; q < n_step_groups; ++q)
+        {
+            auto best = Vec_Type::load(alpha_prev + q * l);
+            auto best_s = Vec_Type::set1(1);
+            for (unsigned b = 1; b < 4; ++b)
+            {
+                auto v = Vec_Type::load(alpha_prev + (b * n_step_groups + q) * l);
+                auto msk = Vec_Type::gt(v, best);
+                best = Vec_Type::max(v, best);
+                best_s = Vec_Type::blend(msk, Vec_Type::set1(1 + b), best_s);
+            }
+            Vec_Type::store(step_m + q * l, best);
+            Vec_Type::store(step_m_slot + q * l, best_s);
+        }
+        // skip groups: max over step groups b2 * 4^(Kmer_Size-2) + r, in skip slot 5 + 4 * b1 + b2
+        for (unsigned r = 0; r < n_skip_groups; ++r)
+        {
+            auto best = Vec_Type::load(step_m + r * l);
+            auto best_s = Vec_Type::add(Vec_Type::mul(Vec_Type::load(step_m_slot + r * l), Vec_Type::set1(4)),
+                                        Vec_Type::set1(1));
+            for (unsigned b2 = 1; b2 < 4; ++b2)
+            {
+                unsigned q = b2 * n_skip_groups + r;
+                auto v = Vec_Type::load(step_m + q * l);
+                auto msk = Vec_Type::gt(v, best);
+                best = Vec_Type::max(v, best);
+                best_s = Vec_Type::blend(msk,
+                                         Vec_Type::add(Vec_Type::mul(Vec_Type::load(step_m_slot + q * l), Vec_Type::set1(4)),
+                                                       Vec_Type::set1(1 + b2)),
+                                         best_s);
+            }
+            Vec_Type::store(skip_m + r * l, best);
+            Vec_Type::store(skip_m_slot + r * l, best_s);
+        }
+        // regular states
+        const Float_Type* log_pr_stay = &_log_pr[0];
+        const Float_Type* log_pr_step = &_log_pr[n_states * l];
+        const Float_Type* log_pr_skip = &_log_pr[2 * n_states * l];
+        for (unsigned j = 0; j < n_states; ++j)
+        {
+            auto best = Vec_Type::add(Vec_Type::load(alpha_prev + j * l), Vec_Type::load(log_pr_stay + j * l));
+            auto best_s = Vec_Type::set1(0);
+            auto v = Vec_Type::add(Vec_Type::load(step_m + (j >> 2) * l), Vec_Type::load(log_pr_step + j * l));
+            auto msk = Vec_Type::gt(v, best);
+            best = Vec_Type::max(v, best);
+            best_s = Vec_Type::blend(msk, Vec_Type::load(step_m_slot + (j >> 2) * l), best_s);
+            v = Vec_Type::add(Vec_Type::load(skip_m + (j >> 4) * l), Vec_Type::load(log_pr_skip + j * l));
+            msk = Vec_Type::gt(v, best);
+            best = Vec_Type::max(v, best);
+            best_s = Vec_Type::blend(msk, Vec_Type::load(skip_m_slot + (j >> 4) * l), best_s);
+            Vec_Type::store(alpha_crt + j * l, Vec_Type::add(best, Vec_Type::load(&_emission[j * l])));
+            Vec_Type::store_u8(traceback_crt + j * l, best_s);
+        }
+        // irregular states: all 21 slots, one lane at a time
+        for (auto j : _irregular_v)
+        {
+            for (unsigned k = 0; k < _n_seqs; ++k)
+            {
+                const Fixed_Shape_Transitions_Type& fst = _st_v[k]->fixed_shape();
+                Float_Type best_v = -INFINITY;
+                unsigned best_s = 0;
+                for (unsigned s = 0; s < Fixed_Shape_Transitions_Type::n_slots; ++s)
+                {
+                    Float_Type v = fst.log_pr(s, j) + alpha_prev[Fixed_Shape_Transitions_Type::pred(s, j) * l + k];
+                    if (v > best_v)
+                    {
+                        best_v = v;
+                        best_s = s;
+                    }
+                }
+                alpha_crt[j * l + k] = best_v + _emission[j * l + k];
+                traceback_crt[j * l + k] = best_s;
+            }
+        }
+    }
+
+    // pick the best last state of the sequences ending at event i
+    void finish_lanes(unsigned i, const Float_Type* alpha_crt)
+    {
+        for (unsigned k = 0; k < _n_seqs; ++k)
+        {
+            if (_n_events[k] != i + 1) continue;
+            for (unsigned j = 0; j < n_states; ++j)
+            {
+                if (alpha_crt[j * n_lanes + k] > _path_probability[k])
+                {
+                    _path_probability[k] = alpha_crt[j * n_lanes + k];
+                    _last_state[k] = j;
+                }
+            }
+        }
+    }
+
+    void fill_state_seq(unsigned k, Event_Sequence_Type& ev)
+    {
+        unsigned j = _last_state[k];
+        for (unsigned i = _n_events[k] - 1; i > 0; --i)
+        {
+            ev[i].model_state_idx = j;
+            unsigned s = _traceback[(static_cast< size_t >(i) * n_states + j) * n_lanes + k];
+            j = Fixed_Shape_Transitions_Type::pred(s, j);
+        }
+        ev[0].model_state_idx = j;
+        for (unsigned i = 0; i < _n_events[k]; ++i)
+        {
+            ev[i].move = i > 0? Kmer_Type::min_skip(ev[i - 1].model_state_idx, ev[i].model_state_idx) : 0u;
+        }
+    }
+}; // class Viterbi_Batch
+
+#endif
@@ -0,0 +1,285 @@
+#ifndef __VITERBI_INT16_HPP
+#define __VITERBI_INT16_HPP
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+#include "Pore_Model.hpp"
+#include "State_Transitions.hpp"
+#include "DP_Arena.hpp"
+#include "Viterbi.hpp"
+#include "simd_support.hpp"
+#include "logger.hpp"
+
+/*
+ * Viterbi on 16-bit saturating integer scores.
+ *
+ * Log transitions and log emissions are quantized to score_scale() units per nat;
+ * emissions are taken relative to the best emission of their event, and every column
+ * is renormalized so that its best score is 0. The offsets removed are summed in
+ * floating point, so only differences between competing paths are held in int16;
+ * scores that fall off the bottom saturate at -32768, which acts as -inf.
+ * Integer lanes are twice as many as float lanes, and score rows take half the memory.
+ *
+ * Requires transitions with the grouped fixed shape (see Fixed_Shape_Transitions).
+ * Rounding can break near-ties differently than the float engine: path_probability()
+ * is the float score of the decoded path, to be compared with Viterbi::path_probability().
+ */
+template < typename Float_Type, unsigned Kmer_Size = 6 >
+class Viterbi_Int16
+{
+public:
+    typedef Kmer< Kmer_Size > Kmer_Type;
+    typedef Pore_Model< Float_Type, Kmer_Size > Pore_Model_Type;
+    typedef State_Transitions< Float_Type, Kmer_Size > State_Transitions_Type;
+    typedef Event< Float_Type, Kmer_Size > Event_Type;
+    typedef Event_Sequence< Float_Type, Kmer_Size > Event_Sequence_Type;
+    typedef typename State_Transitions_Type::Fixed_Shape_Transitions_Type Fixed_Shape_Transitions_Type;
+    typedef Viterbi< Float_Type, Kmer_Size > Viterbi_Type;
+    typedef typename Viterbi_Type::Traceback_Type Traceback_Type;
+    typedef int16_t Score_Type;
+    typedef simd::Vec< Score_Type > Vec_Type;
+    typedef simd::Scalar_Vec< Score_Type > Scalar_Vec_Type;
+
+    static const unsigned n_states = Pore_Model_Type::n_states;
+    static const Score_Type min_score = -32768;
+
+    // quantization units per nat
+    static Float_Type& score_scale() { static Float_Type _score_scale = 16.0; return _score_scale; }
+
+    static bool can_fill(const State_Transitions_Type& st) { return st.fixed_shape().grouped; }
+
+    unsigned n_events() const { return _n_events; }
+    // float score of the decoded path
+    Float_Type path_probability() const { return _path_probability; }
+    // score of the decoded path, as accumulated from quantized scores
+    Float_Type quantized_path_probability() const { return _quantized_path_probability; }
+
+    void fill(const Pore_Model_Type& pm,
+              const State_Transitions_Type& st,
+              Event_Sequence_Type& ev)
+    {
+        static const unsigned n_step_groups = Fixed_Shape_Transitions_Type::n_step_groups;
+        static const unsigned n_skip_groups = Fixed_Shape_Transitions_Type::n_skip_groups;
+        assert(can_fill(st));
+        const Fixed_Shape_Transitions_Type& fst = st.fixed_shape();
+        _n_events = ev.size();
+        _scale = score_scale();
+        _log_pr.resize(3 * n_states);
+        for (unsigned g = 0; g < 3; ++g)
+        {
+            for (unsigned j = 0; j < n_states; ++j)
+            {
+                _log_pr[g * n_states + j] = quantize(fst.log_pr_group_slice(g)[j]);
+            }
+        }
+        _alpha.assign(2 * n_states, static_cast< Score_Type >(min_score));
+        _emission.resize(n_states);
+        _emission_v.resize(n_states);
+        _group_max.resize(n_step_groups + n_skip_groups);
+        _group_slot.resize(n_step_groups + n_skip_groups);
+        _traceback.clear();
+        _traceback.resize(n_states * n_events());
+        // offset: score removed from the integer columns so far, in nats
+        double offset = fill_emission(pm, ev[0]) - std::log(static_cast< double >(n_states));
+        std::copy(_emission.begin(), _emission.end(), alpha_row(0));
+        for (unsigned i = 1; i < n_events(); ++i)
+        {
+            offset += fill_emission(pm, ev[i]);
+            fill_column(fst, alpha_row(i - 1), alpha_row(i), &_traceback[i * n_states]);
+            offset += renormalize(alpha_row(i));
+        }
+        //
+        // best last state: renormalization leaves it at score 0
+        //
+        const Score_Type* alpha_last = alpha_row(n_events() - 1);
+        unsigned j = std::max_element(alpha_last, alpha_last + n_states) - alpha_last;
+        _quantized_path_probability = offset + alpha_last[j] / _scale;
+        for (unsigned i = n_events() - 1; ; --i)
+        {
+            ev[i].model_state_idx = j;
+            if (i == 0) break;
+            j = Fixed_Shape_Transitions_Type::pred(_traceback[i * n_states + j], j);
+        }
+        for (unsigned i = 0; i < n_events(); ++i)
+        {
+            ev[i].move = i > 0? Kmer_Type::min_skip(ev[i - 1].model_state_idx, ev[i].model_state_idx) : 0u;
+        }
+        _path_probability = Viterbi_Type::path_score(pm, st, ev);
+    }
+
+private:
+    std::vector< Score_Type > _alpha;
+    std::vector< Score_Type > _log_pr;
+    std::vector< Score_Type > _emission;
+    std::vector< Float_Type > _emission_v;
+    std::vector< Score_Type > _group_max;
+    std::vector< Score_Type > _group_slot;
+    DP_Arena_Vector< Traceback_Type > _traceback;
+    Float_Type _scale;
+    Float_Type _path_probability;
+    Float_Type _quantized_path_probability;
+    unsigned _n_events;
+
+    Score_Type* alpha_row(unsigned i) { return &_alpha[(i % 2) * n_states]; }
+    const Score_Type* log_pr_group_slice(unsigned g) const { return &_log_pr[g * n_states]; }
+
+    Score_Type quantize(Float_Type v) const
+    {
+        Float_Type q = std::round(v * _scale);
+        return (q > -32768? (q < 32767? static_cast< Score_Type >(q) : 32767) : min_score);
+    }
+
+    // quantize the emissions of event e, relative to the best one; returns the best one
+    Float_Type fill_emission(const Pore_Model_Type& pm, const Event_Type& e)
+    {
+        pm.fill_corrected_emissions(e, &_emission_v[0]);
+        Float_Type max_v = -INFINITY;
+        for (unsigned j = 0; j < n_states; ++j)
+        {
+            max_v = std::max(max_v, _emission_v[j]);
+        }
+        // values are <= 0: truncating v - .5 rounds them; written so that it vectorizes
+        for (unsigned j = 0; j < n_states; ++j)
+        {
+            Float_Type v = std::max((_emission_v[j] - max_v) * _scale, static_cast< Float_Type >(min_score));
+            _emission[j] = static_cast< Score_Type >(v - static_cast< Float_Type >(.5));
+        }
+        return max_v;
+    }
+
+    // subtract the best score from column alpha_crt; returns it, in nats
+    Float_Type renormalize(Score_Type* alpha_crt) const
+    {
+        auto m = Vec_Type::set1(min_score);
+        for (unsigned j = 0; j < n_states; j += Vec_Type::width)
+        {
+            m = Vec_Type::max(m, Vec_Type::load(alpha_crt + j));
+        }
+        Score_Type m_v[Vec_Type::width];
+        Vec_Type::store(m_v, m);
+        Score_Type max_v = *std::max_element(m_v, m_v + Vec_Type::width);
+        auto d = Vec_Type::set1(max_v);
+        for (unsigned j = 0; j < n_states; j += Vec_Type::width)
+        {
+            Vec_Type::store(alpha_crt + j, Vec_Type::sub(Vec_Type::load(alpha_crt + j), d));
+        }
+        return max_v / _scale;
+    }
+
+    // best score and slot over the 4 step predecessors of every step group, and
+    // over the 16 skip predecessors of every skip group, as in Viterbi
+    template < typename V >
+    static void step_group_max(const Score_Type* alpha_prev, Score_Type* m, Score_Type* m_slot,
+                               unsigned q_begin, unsigned q_end)
+    {
+        static const unsigned stride = Fixed_Shape_Transitions_Type::n_step_groups;
+        for (unsigned q = q_begin; q < q_end; q += V::width)
+        {
+            auto best = V::load(alpha_prev + q);
+            auto best_s = V::set1(1);
+            for (unsigned b = 1; b < 4; ++b)
+            {
+                auto v = V::load(alpha_prev + b * stride + q);
+                auto msk = V::gt(v, best);
+                best = V::max(v, best);
+                best_s = V::blend(msk, V::set1(1 + b), best_s);
+            }
+            V::store(m + q, best);
+            V::store(m_slot + q, best_s);
+        }
+    }
+    template < typename V >
+    static void skip_group_max(const Score_Type* step_m, const Score_Type* step_m_slot,
+                               Score_Type* m, Score_Type* m_slot,
+                               unsigned r_begin, unsigned r_end)
+    {
+        static const unsigned stride = Fixed_Shape_Transitions_Type::n_skip_groups;
+        auto times_4 = [] (typename V::type a) { a = V::add(a, a); return V::add(a, a); };
+        for (unsigned r = r_begin; r < r_end; r += V::width)
+        {
+            auto best = V::load(step_m + r);
+            auto best_s = V::add(times_4(V::load(step_m_slot + r)), V::set1(1));
+            for (unsigned b2 = 1; b2 < 4; ++b2)
+            {
+                auto v = V::load(step_m + b2 * stride + r);
+                auto msk = V::gt(v, best);
+                best = V::max(v, best);
+                best_s = V::blend(msk,
+                                  V::add(times_4(V::load(step_m_slot + b2 * stride + r)), V::set1(1 + b2)),
+                                  best_s);
+            }
+            V::store(m + r, best);
+            V::store(m_slot + r, best_s);
+        }
+    }
+
+    void fill_column(const Fixed_Shape_Transitions_Type& fst,
+                     const Score_Type* alpha_prev, Score_Type* alpha_crt, Traceback_Type* traceback_crt)
+    {
+        static const unsigned block_size = 16;
+        static const unsigned n_lanes = Vec_Type::width;
+        static const unsigned n_step_groups = Fixed_Shape_Transitions_Type::n_step_groups;
+        static const unsigned n_skip_groups = Fixed_Shape_Transitions_Type::n_skip_groups;
+        static_assert(block_size % n_lanes == 0, "block size must be a multiple of SIMD width");
+        Score_Type* step_m = &_group_max[0];
+        Score_Type* step_m_slot = &_group_slot[0];
+        Score_Type* skip_m = &_group_max[n_step_groups];
+        Score_Type* skip_m_slot = &_group_slot[n_step_groups];
+        unsigned q_end = n_step_groups - n_step_groups % n_lanes;
+        step_group_max< Vec_Type >(alpha_prev, step_m, step_m_slot, 0, q_end);
+        step_group_max< Scalar_Vec_Type >(alpha_prev, step_m, step_m_slot, q_end, n_step_groups);
+        unsigned r_end = n_skip_groups - n_skip_groups % n_lanes;
+        skip_group_max< Vec_Type >(step_m, step_m_slot, skip_m, skip_m_slot, 0, r_end);
+        skip_group_max< Scalar_Vec_Type >(step_m, step_m_slot, skip_m, skip_m_slot, r_end, n_skip_groups);
+        Score_Type step_v[block_size];
+        Score_Type step_s[block_size];
+        for (unsigned j0 = 0; j0 < n_states; j0 += block_size)
+        {
+            for (unsigned k = 0; k < block_size; ++k)
+            {
+                step_v[k] = step_m[(j0 + k) >> 2];
+                step_s[k] = step_m_slot[(j0 + k) >> 2];
+            }
+            auto skip_v = Vec_Type::set1(skip_m[j0 >> 4]);
+            auto skip_s = Vec_Type::set1(skip_m_slot[j0 >> 4]);
+            for (unsigned k = 0; k < block_size; k += n_lanes)
+            {
+                unsigned j = j0 + k;
+                auto best = Vec_Type::add(Vec_Type::load(alpha_prev + j), Vec_Type::load(log_pr_group_slice(0) + j));
+                auto best_s = Vec_Type::set1(0);
+                auto v = Vec_Type::add(Vec_Type::load(&step_v[k]), Vec_Type::load(log_pr_group_slice(1) + j));
+                auto msk = Vec_Type::gt(v, best);
+                best = Vec_Type::max(v, best);
+                best_s = Vec_Type::blend(msk, Vec_Type::load(&step_s[k]), best_s);
+                v = Vec_Type::add(skip_v, Vec_Type::load(log_pr_group_slice(2) + j));
+                msk = Vec_Type::gt(v, best);
+                best = Vec_Type::max(v, best);
+                best_s = Vec_Type::blend(msk, skip_s, best_s);
+                Vec_Type::store(alpha_crt + j, Vec_Type::add(best, Vec_Type::load(&_emission[j])));
+                Vec_Type::store_u8(traceback_crt + j, best_s);
+            }
+        }
+        for (auto j : fst.irregular_v)
+        {
+            Score_Type best_v = min_score;
+            unsigned best_s = 0;
+            for (unsigned s = 0; s < Fixed_Shape_Transitions_Type::n_slots; ++s)
+            {
+                Score_Type v = Scalar_Vec_Type::add(quantize(fst.log_pr(s, j)),
+                                                    alpha_prev[Fixed_Shape_Transitions_Type::pred(s, j)]);
+                if (v > best_v)
+                {
+                    best_v = v;
+                    best_s = s;
+                }
+            }
+            alpha_crt[j] = Scalar_Vec_Type::add(best_v, _emission[j]);
+            traceback_crt[j] = best_s;
+        }
+    }
+}; // class Viterbi_Int16
+
+#endif
@@ -0,0 +1,140 @@
+#ifndef __WINDOWED_VITERBI_HPP
+#define __WINDOWED_VITERBI_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <vector>
+
+#include "Pore_Model.hpp"
+#include "State_Transitions.hpp"
+#include "Viterbi.hpp"
+#include "thread_support.hpp"
+#include "logger.hpp"
+
+/*
+ * Viterbi decoding of long strands in overlapping windows.
+ *
+ * Window k owns events [k * W, (k + 1) * W), and is decoded on the events within
+ * window_overlap() of that range, so that its path is settled where it meets
+ * its neighbours. Windows are decoded independently by up to n_threads() threads,
+ * taking the calling one and those left idle by the outer pool (see Spare_Threads),
+ * each holding a single window at a time; window fills are single-threaded. Consecutive paths are stitched at the event
+ * closest to the window boundary where they agree on the state; such an event
+ * exists unless the overlap is shorter than the distance it takes Viterbi paths
+ * to merge. The path probability is that of the stitched path; a transition
+ * missing at a seam where the paths never agree is not counted.
+ */
+template < typename Float_Type, unsigned Kmer_Size = 6 >
+class Windowed_Viterbi
+{
+public:
+    typedef Kmer< Kmer_Size > Kmer_Type;
+    typedef Pore_Model< Float_Type, Kmer_Size > Pore_Model_Type;
+    typedef State_Transitions< Float_Type, Kmer_Size > State_Transitions_Type;
+    typedef Event_Sequence< Float_Type, Kmer_Size > Event_Sequence_Type;
+    typedef Viterbi< Float_Type, Kmer_Size > Viterbi_Type;
+
+    static const unsigned n_states = Pore_Model_Type::n_states;
+
+    // strands with more than window_events() events are decoded in windows; 0 disables this
+    static unsigned& window_events() { static unsigned _window_events = 0; return _window_events; }
+    static unsigned& window_overlap() { static unsigned _window_overlap = 200; return _window_overlap; }
+    static unsigned& n_threads() { static unsigned _n_threads = 1; return _n_threads; }
+
+    static bool use_windows(unsigned n_events)
+    {
+        return window_events() > 0 and n_events > window_events();
+    }
+
+    unsigned n_windows() const { return _state_v.size(); }
+    // number of seams where the paths of consecutive windows do not agree on any state
+    unsigned n_broken_seams() const { return _n_broken_seams; }
+    Float_Type path_probability() const { return _path_probability; }
+
+    void fill(const Pore_Model_Type& pm,
+              const State_Transitions_Type& st,
+              Event_Sequence_Type& ev)
+    {
+        unsigned n_events = ev.size();
+        unsigned w = std::max(window_events(), 1u);
+        unsigned n_windows = (n_events - 1) / w + 1;
+        _state_v.clear();
+        _state_v.resize(n_windows);
+        _window_begin.resize(n_windows);
+        //
+        // decode windows
+        //
+        std::atomic< unsigned > crt_window(0);
+        Spare_Threads::Loan loan(std::min(std::max(n_threads(), 1u), n_windows) - 1);
+        Thread_Team team(1 + loan.size());
+        team.run([&] (unsigned) {
+            Event_Sequence_Type window_ev;
+            for (unsigned k = crt_window++; k < n_windows; k = crt_window++)
+            {
+                unsigned i_begin = k * w > window_overlap()? k * w - window_overlap() : 0;
+                unsigned i_end = std::min((k + 1) * w + window_overlap(), n_events);
+                window_ev.assign(ev.begin() + i_begin, ev.begin() + i_end);
+                Viterbi_Type vit;
+                vit.fill(pm, st, window_ev, 1);
+                _window_begin[k] = i_begin;
+                _state_v[k].resize(i_end - i_begin);
+                for (unsigned i = 0; i < i_end - i_begin; ++i)
+                {
+                    _state_v[k][i] = window_ev[i].model_state_idx;
+                }
+            }
+        });
+        //
+        // stitch: event i takes the state of window k for i in [seam[k], seam[k + 1])
+        //
+        std::vector< unsigned > seam(n_windows + 1);
+        seam[0] = 0;
+        seam[n_windows] = n_events;
+        _n_broken_seams = 0;
+        for (unsigned k = 1; k < n_windows; ++k)
+        {
+            seam[k] = find_seam(k - 1, k, k * w);
+        }
+        for (unsigned k = 0; k < n_windows; ++k)
+        {
+            for (unsigned i = seam[k]; i < seam[k + 1]; ++i)
+            {
+                ev[i].model_state_idx = _state_v[k][i - _window_begin[k]];
+                ev[i].move = i > 0? Kmer_Type::min_skip(ev[i - 1].model_state_idx, ev[i].model_state_idx) : 0u;
+            }
+        }
+        _path_probability = Viterbi_Type::path_score(pm, st, ev);
+        LOG("Windowed_Viterbi", debug)
+            << "n_events=" << n_events << " n_windows=" << n_windows
+            << " n_broken_seams=" << _n_broken_seams << std::endl;
+    }
+
+private:
+    // state path of each window, starting at event _window_begin[k]
+    std::vector< std::vector< unsigned > > _state_v;
+    std::vector< unsigned > _window_begin;
+    Float_Type _path_probability;
+    unsigned _n_broken_seams;
+
+    // first event taken from window k1, chosen in the overlap with window k0
+    // as the closest to the boundary b where both windows agree
+    unsigned find_seam(unsigned k0, unsigned k1, unsigned b)
+    {
+        unsigned lo = _window_begin[k1];
+        unsigned hi = _window_begin[k0] + _state_v[k0].size();
+        auto agree = [&] (unsigned i) {
+            return _state_v[k0][i - _window_begin[k0]] == _state_v[k1][i - lo];
+        };
+        for (unsigned d = 0; b >= lo + d or b + d < hi; ++d)
+        {
+            if (b + d < hi and agree(b + d)) return b + d;
+            if (d > 0 and b >= lo + d and agree(b - d)) return b - d;
+        }
+        LOG("Windowed_Viterbi", debug) << "no agreement in overlap at event " << b << std::endl;
+        ++_n_broken_seams;
+        return b;
+    }
+}; // class Windowed_Viterbi
+
+#endif
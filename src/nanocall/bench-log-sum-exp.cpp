@@ -0,0 +1,122 @@
+#include <chrono>
+#include <cmath>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+#include <tclap/CmdLine.h>
+
+#include "Log_Sum_Exp.hpp"
+#include "logsumset.hpp"
+#include "logger.hpp"
+
+using namespace std;
+
+#ifndef FLOAT_TYPE
+#define FLOAT_TYPE float
+#endif
+typedef logsum::logsumset< FLOAT_TYPE > LogSumSet_Type;
+typedef Log_Sum_Exp< FLOAT_TYPE > Log_Sum_Exp_Type;
+
+namespace opts
+{
+    using namespace TCLAP;
+    string description =
+        "Compare the speed and accuracy of Log_Sum_Exp against logsum::logsumset, the "
+        "accumulator it replaces, on groups of random log values, as accumulated by the DP "
+        "and training loops";
+    CmdLine cmd_parser(description);
+    MultiArg< string > log_level("d", "log-level", "Log level.", false, "string", cmd_parser);
+    ValueArg< unsigned > group_size("g", "group-size", "Values added between clear() and val().", false, 21, "int", cmd_parser);
+    ValueArg< unsigned > n_groups("n", "n-groups", "Number of groups.", false, 100000, "int", cmd_parser);
+    ValueArg< double > spread("s", "spread", "Values are uniform in [-spread, 0].", false, 30.0, "float", cmd_parser);
+    ValueArg< unsigned > seed("", "seed", "Random seed.", false, 1, "int", cmd_parser);
+} // namespace opts
+
+// results of the current implementation, logsum::logsumset, which the others are compared to
+struct Baseline
+{
+    double ns_per_value;
+    vector< FLOAT_TYPE > res;
+};
+
+// accumulate every group with s, as the DP loops do (clear, add the group, val); report the time
+// per value and the max abs error against ref; with a baseline, also report the speedup over it,
+// and the max abs difference to its results
+template < typename Accumulator >
+Baseline run(const string& name, Accumulator& s,
+             const vector< FLOAT_TYPE >& v, const vector< double >& ref, const Baseline* baseline_p)
+{
+    unsigned g = opts::group_size;
+    Baseline b;
+    b.res.resize(ref.size());
+    auto t0 = chrono::steady_clock::now();
+    for (unsigned k = 0; k < ref.size(); ++k)
+    {
+        s.clear();
+        for (unsigned l = k * g; l < (k + 1) * g; ++l)
+        {
+            s.add(v[l]);
+        }
+        b.res[k] = s.val();
+    }
+    auto t1 = chrono::steady_clock::now();
+    double max_err = 0.0;
+    for (unsigned k = 0; k < ref.size(); ++k)
+    {
+        max_err = max(max_err, abs(b.res[k] - ref[k]));
+    }
+    b.ns_per_value = chrono::duration_cast< chrono::nanoseconds >(t1 - t0).count() / double(v.size());
+    cout << name << "\tns_per_value=" << b.ns_per_value << "\tmax_abs_err=" << max_err;
+    if (baseline_p)
+    {
+        double max_diff = 0.0;
+        for (unsigned k = 0; k < ref.size(); ++k)
+        {
+            max_diff = max< double >(max_diff, abs(b.res[k] - baseline_p->res[k]));
+        }
+        cout << "\tspeedup_vs_logsumset=" << baseline_p->ns_per_value / b.ns_per_value
+             << "\tmax_abs_diff_vs_logsumset=" << max_diff;
+    }
+    cout << endl;
+    return b;
+}
+
+void real_main()
+{
+    unsigned g = opts::group_size;
+    unsigned n = opts::n_groups;
+    mt19937 rg(opts::seed);
+    uniform_real_distribution< double > unif(-opts::spread, 0.0);
+    vector< FLOAT_TYPE > v(static_cast< size_t >(g) * n);
+    for (auto& x : v)
+    {
+        x = unif(rg);
+    }
+    // reference: double precision, std::exp
+    vector< double > ref(n);
+    for (unsigned k = 0; k < n; ++k)
+    {
+        double m = -INFINITY;
+        for (unsigned l = k * g; l < (k + 1) * g; ++l) m = max< double >(m, v[l]);
+        double s = 0.0;
+        for (unsigned l = k * g; l < (k + 1) * g; ++l) s += exp(v[l] - m);
+        ref[k] = m + log(s);
+    }
+    // constructed as the DP and training loops used it
+    LogSumSet_Type lss(false);
+    Baseline baseline = run("logsumset", lss, v, ref, nullptr);
+    for (unsigned d : { 0u, 3u, 5u, 6u, 7u })
+    {
+        Log_Sum_Exp_Type::exp_degree() = d;
+        Log_Sum_Exp_Type s;
+        run("log_sum_exp_degree_" + to_string(d), s, v, ref, &baseline);
+    }
+}
+
+int main(int argc, char * argv[])
+{
+    opts::cmd_parser.parse(argc, argv);
+    logger::Logger::set_levels_from_options(opts::log_level);
+    real_main();
+}
@@ -1,5 +1,9 @@
+#include <atomic>
 #include <deque>
 #include <iostream>
+#include <map>
+#include <memory>
+#include <sstream>
 #include <string>
 #include <tclap/CmdLine.h>
 
@@ -13,7 +17,13 @@
 #include "Event.hpp"
 #include "Fast5_Summary.hpp"
 #include "Viterbi.hpp"
+#include "Viterbi_Batch.hpp"
+#include "Windowed_Viterbi.hpp"
+#include "Online_Viterbi.hpp"
+#include "Viterbi_Int16.hpp"
 #include "Forward_Backward.hpp"
+#include "Log_Sum_Exp.hpp"
+#include "Emission_Matrix.hpp"
 #include "Parameter_Trainer.hpp"
 #include "logger.hpp"
 #include "alg.hpp"
@@ -21,6 +31,7 @@
 #include "fast5.hpp"
 #include "pfor.hpp"
 #include "fs_support.hpp"
+#include "thread_support.hpp"
 
 using namespace std;
 
@@ -45,7 +56,15 @@ typedef Event< FLOAT_TYPE, KMER_SIZE > Event_Type;
 typedef Event_Sequence< FLOAT_TYPE, KMER_SIZE > Event_Sequence_Type;
 typedef Fast5_Summary< FLOAT_TYPE, KMER_SIZE > Fast5_Summary_Type;
 typedef Parameter_Trainer< FLOAT_TYPE, KMER_SIZE > Parameter_Trainer_Type;
+typedef Parameter_Trainer_Type::Train_Data Train_Data_Type;
 typedef Viterbi< FLOAT_TYPE, KMER_SIZE > Viterbi_Type;
+typedef Viterbi_Batch< FLOAT_TYPE, KMER_SIZE > Viterbi_Batch_Type;
+typedef Windowed_Viterbi< FLOAT_TYPE, KMER_SIZE > Windowed_Viterbi_Type;
+typedef Online_Viterbi< FLOAT_TYPE, KMER_SIZE > Online_Viterbi_Type;
+typedef Viterbi_Int16< FLOAT_TYPE, KMER_SIZE > Viterbi_Int16_Type;
+typedef Emission_Matrix< FLOAT_TYPE, KMER_SIZE > Emission_Matrix_Type;
+typedef Parameter_Trainer_Type::Forward_Backward_Type Forward_Backward_Type;
+typedef Log_Sum_Exp< FLOAT_TYPE > Log_Sum_Exp_Type;
 
 namespace opts
 {
@@ -62,14 +81,36 @@ namespace opts
     ValueArg< unsigned > trim_ed_hp_start("", "trim-ed-hp-start", "Number of events to trim before hairpin start.", false, 50, "int", cmd_parser);
     ValueArg< unsigned > trim_ed_sq_end("", "trim-ed-sq-end", "Number of events to trim before sequence end.", false, 50, "int", cmd_parser);
     ValueArg< unsigned > trim_ed_sq_start("", "trim-ed-sq-start", "Number of events to trim after sequence start.", false, 50, "int", cmd_parser);
-    ValueArg< unsigned > max_ed_events("", "max-ed-events", "Maximum EventDetection events.", false, 100000, "int", cmd_parser);
+    ValueArg< unsigned > max_ed_events("", "max-ed-events", "Maximum EventDetection events (0: no limit).", false, 0, "int", cmd_parser);
     ValueArg< unsigned > min_ed_events("", "min-ed-events", "Minimum EventDetection events.", false, 10, "int", cmd_parser);
+    ValueArg< double > merge_events_t("", "merge-events-t", "Merge adjacent events whose means differ by at most this many standard errors (0: no merging).", false, 0.0, "float", cmd_parser);
+    ValueArg< unsigned > viterbi_checkpoint_events("", "viterbi-checkpoint-events", "Use checkpointed Viterbi (less memory, more time) for strands with at least this many events (0: never).", false, 50000, "int", cmd_parser);
+    ValueArg< unsigned > viterbi_checkpoint_interval("", "viterbi-checkpoint-interval", "Events between Viterbi checkpoints. (default: square root of strand size)", false, 0, "int", cmd_parser);
+    ValueArg< unsigned > viterbi_parallel_events("", "viterbi-parallel-events", "Split Viterbi of strands with at least this many events across threads left idle by other reads (0: never).", false, 20000, "int", cmd_parser);
+    ValueArg< unsigned > viterbi_window_events("", "viterbi-window-events", "Basecall strands with more events in overlapping windows of this many events, decoded in parallel (0: never).", false, 0, "int", cmd_parser);
+    ValueArg< unsigned > viterbi_window_overlap("", "viterbi-window-overlap", "Events shared by neighbouring Viterbi windows, on each side.", false, 200, "int", cmd_parser);
+    ValueArg< unsigned > viterbi_batch_max_events("", "viterbi-batch-max-events", "Basecall strands with at most this many events in batches of similar length, one per SIMD lane (0: never).", false, 5000, "int", cmd_parser);
+    ValueArg< unsigned > emission_matrix_mb("", "emission-matrix-mb", "Maximum size in MB of the emission matrix precomputed per strand for training; longer strands compute emissions on the fly (0: always).", false, 16, "int", cmd_parser);
+    ValueArg< float > sparse_emission_stdvs("", "sparse-emission-stdvs", "In Viterbi, compute emissions exactly only for kmers with levels within this many level stdvs of the event, and use a floor for the rest (0: exact everywhere). Beam search and training always use exact emissions.", false, 0.0, "float", cmd_parser);
+    SwitchArg viterbi_int16("", "viterbi-int16", "Basecall with 16-bit integer Viterbi scores, on strands below the checkpointing threshold.", cmd_parser);
+    ValueArg< float > viterbi_int16_scale("", "viterbi-int16-scale", "Integer Viterbi score units per nat.", false, 16.0, "float", cmd_parser);
+    SwitchArg viterbi_int16_report("", "viterbi-int16-report", "Also run float Viterbi, and report its agreement with integer Viterbi.", cmd_parser);
+    ValueArg< unsigned > race_chunk_events("", "race-chunk-events", "Without a preferred model, race candidate models over chunks of this many events, and keep the decoding of the winner (0: no racing).", false, 0, "int", cmd_parser);
+    ValueArg< float > race_margin("", "race-margin", "Drop a racing model when its partial log score trails the best one by this much.", false, 100.0, "float", cmd_parser);
+    ValueArg< string > beam("", "beam", "Viterbi beam search mode. (default: none)", false, "none", "none|width|threshold|adaptive", cmd_parser);
+    ValueArg< unsigned > beam_width("", "beam-width", "Viterbi beam width, or minimum width in adaptive mode.", false, 64, "int", cmd_parser);
+    ValueArg< unsigned > beam_max_width("", "beam-max-width", "Maximum Viterbi beam width in adaptive mode.", false, 1024, "int", cmd_parser);
+    ValueArg< float > beam_threshold("", "beam-threshold", "Keep Viterbi states within this log score of the best one, in threshold mode.", false, 10.0, "float", cmd_parser);
+    ValueArg< unsigned > dp_arena_mb("", "dp-arena-mb", "Memory kept over all threads for reuse by DP matrices of later reads, in MB (0: none).", false, 512, "int", cmd_parser);
+    SwitchArg huge_pages("", "huge-pages", "Back large DP matrices with transparent huge pages.", cmd_parser);
     ValueArg< unsigned > fasta_line_width("", "fasta-line-width", "Maximum fasta line width.", false, 80, "int", cmd_parser);
     //
     ValueArg< float > scaling_select_threshold("", "scaling-select-threshold", "Select best model per strand during scaling if log score better by threshold.", false, 20.0, "float", cmd_parser);
     ValueArg< float > scaling_min_progress("", "scaling-min-progress", "Minimum scaling fit progress.", false, 1.0, "float", cmd_parser);
     ValueArg< unsigned > scaling_max_rounds("", "scaling-max-rounds", "Maximum scaling rounds.", false, 10, "int", cmd_parser);
     ValueArg< unsigned > scaling_num_events("", "scaling-num-events", "Number of events used for model scaling.", false, 200, "int", cmd_parser);
+    ValueArg< unsigned > log_sum_exp_degree("", "log-sum-exp-degree", "Degree of the polynomial exponential in log-space sums, from 2 to 7 (0: std::exp).", false, 6, "int", cmd_parser);
+    ValueArg< float > posterior_mass("", "posterior-mass", "During training, keep for every event its most likely states covering this posterior mass (1: keep all).", false, .999, "float", cmd_parser);
     //
     SwitchArg template_only("", "1d", "Interpret entire read as 1D template only.", cmd_parser);
     SwitchArg single_strand_scaling("", "single-strand-scaling", "Train scaling parameters per strand.", cmd_parser);
@@ -279,21 +320,30 @@ void train_reads(const Pore_Model_Dict_Type& models,
     auto time_start_ms = get_cpu_time_ms();
     Parameter_Trainer_Type::init();
     unsigned crt_idx = 0;
+    Spare_Threads::start_pool(opts::num_threads);
     pfor::pfor< unsigned >(
         opts::num_threads,
         opts::chunk_size,
         // get_item
         [&] (unsigned& i) {
-            if (crt_idx >= reads.size()) return false;
+            if (crt_idx >= reads.size())
+            {
+                Spare_Threads::no_more_items();
+                return false;
+            }
             i = crt_idx++;
+            Spare_Threads::claim();
             return true;
         },
         // process item
         [&] (unsigned& i) {
+            Spare_Threads::Item item;
             Fast5_Summary_Type& read_summary = reads[i];
             if (read_summary.num_ed_events == 0) return;
             global_assert::global_msg() = read_summary.read_id;
             read_summary.load_events();
+            // storage reused by all training rounds on this read
+            Train_Data_Type train_data;
             //
             // create per-strand list of models to try
             //
@@ -372,6 +422,7 @@ void train_reads(const Pore_Model_Dict_Type& models,
                             bool done;
 
                             Parameter_Trainer_Type::train_one_round(
+                                train_data,
                                 train_event_seq_ptrs,
                                 {{ &models.at(m_name_0), &models.at(m_name_1) }},
                                 default_transitions,
@@ -431,7 +482,9 @@ void train_reads(const Pore_Model_Dict_Type& models,
                             << "] pm_params [" << crt_pm_params
                             << "] st_params [" << crt_st_params[0] << "," << crt_st_params[1]
                             << "] fit [" << crt_fit
-                            << "] rounds [" << round << "]" << endl;
+                            << "] rounds [" << round
+                            << "] pruned_mass [" << train_data.avg_pruned_mass << "," << train_data.max_pruned_mass
+                            << "]" << endl;
                     } // for m_name[1]
                 } // for m_name[0]
                 if (opts::scaling_select_threshold.get() < INFINITY)
@@ -488,6 +541,7 @@ void train_reads(const Pore_Model_Dict_Type& models,
                             bool done;
 
                             Parameter_Trainer_Type::train_one_round(
+                                train_data,
                                 train_event_seq_ptrs,
                                 {{ &models.at(m_name), &models.at(m_name) }},
                                 default_transitions,
@@ -547,7 +601,9 @@ void train_reads(const Pore_Model_Dict_Type& models,
                             << "] pm_params [" << crt_pm_params
                             << "] st_params [" << crt_st_params[st]
                             << "] fit [" << crt_fit
-                            << "] rounds [" << round << "]" << endl;
+                            << "] rounds [" << round
+                            << "] pruned_mass [" << train_data.avg_pruned_mass << "," << train_data.max_pruned_mass
+                            << "]" << endl;
                     } // for m_name
                     if (opts::scaling_select_threshold.get() < INFINITY)
                     {
@@ -577,6 +633,7 @@ void train_reads(const Pore_Model_Dict_Type& models,
             clog << "Processed " << setw(6) << right << items << " reads in "
                  << setw(6) << right << seconds << " seconds\r";
         }); // pfor
+    Spare_Threads::end_pool();
     auto time_end_ms = get_cpu_time_ms();
     LOG(info) << "training user_cpu_secs=" << (time_end_ms - time_start_ms)/1000 << endl;
 } // train_reads
@@ -590,6 +647,231 @@ void write_fasta(ostream& os, const string& name, const string& seq)
     }
 } // write_fasta
 
+// one strand to basecall with one model
+struct Basecall_Job
+{
+    string read_id;
+    unsigned st;
+    string m_name;
+    Pore_Model_Type pm;
+    State_Transitions_Type custom_transitions;
+    const State_Transitions_Type* transitions_ptr;
+    Event_Sequence_Type events;
+    FLOAT_TYPE log_path_prob;
+    bool eliminated;
+    // set when the race already decoded the strand
+    bool decoded;
+};
+
+bool use_viterbi_batch()
+{
+    return (not opts::viterbi_int16
+            and opts::viterbi_batch_max_events > 0
+            and Viterbi_Batch_Type::n_lanes > 1
+            and Viterbi_Type::beam_mode() == Viterbi_Type::no_beam);
+}
+
+// race candidates, each a job per strand (or no_job), on the same events: exact online Viterbi
+// decoders are advanced race_chunk_events at a time, and candidates whose partial score, summed
+// over strands, trails the best one by more than race_margin are marked eliminated; when one
+// candidate is left, or when the events run out (the best score wins), the decoders of the
+// winner are run to the end of its strands, and its jobs are marked decoded
+void race_basecall_jobs(deque< Basecall_Job >& jobs, const vector< array< unsigned, 2 > >& candidates)
+{
+    static const unsigned no_job = -1;
+    if (candidates.size() < 2) return;
+    vector< array< unique_ptr< Online_Viterbi_Type >, 2 > > vit_v(candidates.size());
+    vector< unsigned > active;
+    for (unsigned c = 0; c < candidates.size(); ++c)
+    {
+        active.push_back(c);
+        for (unsigned st = 0; st < 2; ++st)
+        {
+            if (candidates[c][st] == no_job or jobs[candidates[c][st]].events.empty()) continue;
+            Basecall_Job& job = jobs[candidates[c][st]];
+            vit_v[c][st].reset(new Online_Viterbi_Type(job.pm, *job.transitions_ptr, 0));
+        }
+    }
+    unsigned n_events_done = 0;
+    bool events_left = true;
+    while (active.size() > 1)
+    {
+        unsigned n_events_end = n_events_done + opts::race_chunk_events;
+        events_left = false;
+        vector< FLOAT_TYPE > score(candidates.size(), 0);
+        for (unsigned c : active)
+        {
+            for (unsigned st = 0; st < 2; ++st)
+            {
+                if (not vit_v[c][st]) continue;
+                Basecall_Job& job = jobs[candidates[c][st]];
+                Online_Viterbi_Type& vit = *vit_v[c][st];
+                unsigned i_end = min< size_t >(n_events_end, job.events.size());
+                for (unsigned i = n_events_done; i < i_end; ++i)
+                {
+                    vit.push(job.events[i]);
+                }
+                events_left = events_left or i_end < job.events.size();
+                score[c] += *max_element(vit.last_column(), vit.last_column() + Viterbi_Type::n_states);
+            }
+        }
+        n_events_done = n_events_end;
+        FLOAT_TYPE best_score = -INFINITY;
+        unsigned best_c = active.front();
+        for (unsigned c : active)
+        {
+            if (score[c] > best_score)
+            {
+                best_score = score[c];
+                best_c = c;
+            }
+        }
+        vector< unsigned > next_active;
+        for (unsigned c : active)
+        {
+            if (events_left? score[c] >= best_score - opts::race_margin : c == best_c)
+            {
+                next_active.push_back(c);
+                continue;
+            }
+            for (unsigned st = 0; st < 2; ++st)
+            {
+                if (candidates[c][st] == no_job) continue;
+                Basecall_Job& job = jobs[candidates[c][st]];
+                job.eliminated = true;
+                LOG(info)
+                    << "race_eliminated read [" << job.read_id
+                    << "] strand [" << job.st
+                    << "] model [" << job.m_name
+                    << "] events [" << min< size_t >(n_events_done, job.events.size())
+                    << "] score_gap [" << best_score - score[c] << "]" << endl;
+            }
+            vit_v[c][0].reset();
+            vit_v[c][1].reset();
+        }
+        active.swap(next_active);
+    }
+    // the winner keeps its decoders: only the events past the race are decoded
+    unsigned c = active.front();
+    for (unsigned st = 0; st < 2; ++st)
+    {
+        if (not vit_v[c][st]) continue;
+        Basecall_Job& job = jobs[candidates[c][st]];
+        Online_Viterbi_Type& vit = *vit_v[c][st];
+        for (unsigned i = vit.n_events(); i < job.events.size(); ++i)
+        {
+            vit.push(job.events[i]);
+        }
+        vit.finish();
+        vector< unsigned > state_v = vit.take_states();
+        for (unsigned i = 0; i < job.events.size(); ++i)
+        {
+            job.events[i].model_state_idx = state_v[i];
+            job.events[i].move = i > 0? Online_Viterbi_Type::Kmer_Type::min_skip(state_v[i - 1], state_v[i]) : 0u;
+        }
+        job.log_path_prob = vit.path_probability();
+        job.decoded = true;
+    }
+} // race_basecall_jobs
+
+// run Viterbi on all jobs; short strands are basecalled in lockstep, in batches of similar length
+void run_basecall_jobs(deque< Basecall_Job >& jobs)
+{
+    vector< Basecall_Job* > batch_jobs;
+    for (auto& job : jobs)
+    {
+        if (job.eliminated or job.decoded) continue;
+        if (Windowed_Viterbi_Type::use_windows(job.events.size()))
+        {
+            Windowed_Viterbi_Type vit;
+            vit.fill(job.pm, *job.transitions_ptr, job.events);
+            job.log_path_prob = vit.path_probability();
+            LOG(info)
+                << "windows read [" << job.read_id
+                << "] strand [" << job.st
+                << "] model [" << job.m_name
+                << "] n_windows [" << vit.n_windows()
+                << "] n_broken_seams [" << vit.n_broken_seams() << "]" << endl;
+            continue;
+        }
+        if (opts::viterbi_int16
+            and Viterbi_Int16_Type::can_fill(*job.transitions_ptr)
+            and (Viterbi_Type::checkpoint_min_events() == 0
+                 or job.events.size() < Viterbi_Type::checkpoint_min_events()))
+        {
+            Event_Sequence_Type float_events;
+            if (opts::viterbi_int16_report)
+            {
+                float_events = job.events;
+            }
+            Viterbi_Int16_Type vit;
+            vit.fill(job.pm, *job.transitions_ptr, job.events);
+            job.log_path_prob = vit.path_probability();
+            if (opts::viterbi_int16_report)
+            {
+                Viterbi_Type float_vit;
+                float_vit.fill(job.pm, *job.transitions_ptr, float_events);
+                unsigned n_mismatches = 0;
+                for (unsigned i = 0; i < job.events.size(); ++i)
+                {
+                    n_mismatches += job.events[i].model_state_idx != float_events[i].model_state_idx;
+                }
+                LOG(info)
+                    << "int16_agreement read [" << job.read_id
+                    << "] strand [" << job.st
+                    << "] model [" << job.m_name
+                    << "] float_log_path_prob [" << float_vit.path_probability()
+                    << "] int16_log_path_prob [" << vit.path_probability()
+                    << "] int16_quantized_log_path_prob [" << vit.quantized_path_probability()
+                    << "] state_mismatches [" << n_mismatches << "/" << job.events.size() << "]" << endl;
+            }
+            continue;
+        }
+        if (use_viterbi_batch()
+            and job.events.size() <= opts::viterbi_batch_max_events
+            and Viterbi_Batch_Type::can_batch(*job.transitions_ptr))
+        {
+            batch_jobs.push_back(&job);
+            continue;
+        }
+        Viterbi_Type vit;
+        vit.fill(job.pm, *job.transitions_ptr, job.events);
+        job.log_path_prob = vit.path_probability();
+        if (Viterbi_Type::beam_mode() != Viterbi_Type::no_beam)
+        {
+            LOG(info)
+                << "beam read [" << job.read_id
+                << "] strand [" << job.st
+                << "] model [" << job.m_name
+                << "] expanded [" << vit.n_expanded()
+                << "] pruned [" << vit.n_pruned() << "]" << endl;
+        }
+    }
+    stable_sort(batch_jobs.begin(),
+                batch_jobs.end(),
+                [] (const Basecall_Job* lhs, const Basecall_Job* rhs) {
+                    return lhs->events.size() < rhs->events.size();
+                });
+    for (unsigned k = 0; k < batch_jobs.size(); k += Viterbi_Batch_Type::n_lanes)
+    {
+        vector< const Pore_Model_Type* > pm_v;
+        vector< const State_Transitions_Type* > st_v;
+        vector< Event_Sequence_Type* > ev_v;
+        for (unsigned l = k; l < min< size_t >(k + Viterbi_Batch_Type::n_lanes, batch_jobs.size()); ++l)
+        {
+            pm_v.push_back(&batch_jobs[l]->pm);
+            st_v.push_back(batch_jobs[l]->transitions_ptr);
+            ev_v.push_back(&batch_jobs[l]->events);
+        }
+        Viterbi_Batch_Type vit_batch;
+        vit_batch.fill(pm_v, st_v, ev_v);
+        for (unsigned l = 0; l < ev_v.size(); ++l)
+        {
+            batch_jobs[k + l]->log_path_prob = vit_batch.path_probability(l);
+        }
+    }
+} // run_basecall_jobs
+
 void basecall_reads(const Pore_Model_Dict_Type& models,
                     const State_Transitions_Type& default_transitions,
                     deque< Fast5_Summary_Type >& reads)
@@ -607,263 +889,377 @@ void basecall_reads(const Pore_Model_Dict_Type& models,
         os_p = &cout;
     }
 
+    // with batched Viterbi, reads are processed in groups of similar length,
+    // whose strands are basecalled together; reads are only reordered within
+    // windows of batch_sort_groups groups, and their output is written back
+    // in input order, by rank among the reads with events
+    static const unsigned batch_sort_groups = 64;
+    vector< vector< unsigned > > read_groups;
+    vector< unsigned > read_rank(reads.size());
+    {
+        vector< unsigned > read_idx;
+        for (unsigned i = 0; i < reads.size(); ++i)
+        {
+            if (reads[i].num_ed_events == 0) continue;
+            read_rank[i] = read_idx.size();
+            read_idx.push_back(i);
+        }
+        unsigned group_size = 1;
+        if (use_viterbi_batch())
+        {
+            group_size = Viterbi_Batch_Type::n_lanes;
+            for (unsigned k = 0; k < read_idx.size(); k += group_size * batch_sort_groups)
+            {
+                stable_sort(read_idx.begin() + k,
+                            read_idx.begin() + min< size_t >(k + group_size * batch_sort_groups, read_idx.size()),
+                            [&] (unsigned lhs, unsigned rhs) {
+                                return reads[lhs].num_ed_events < reads[rhs].num_ed_events;
+                            });
+            }
+        }
+        for (unsigned k = 0; k < read_idx.size(); k += group_size)
+        {
+            read_groups.emplace_back(read_idx.begin() + k,
+                                     read_idx.begin() + min< size_t >(k + group_size, read_idx.size()));
+        }
+    }
+
     unsigned crt_idx = 0;
-    pfor::pfor< unsigned, ostringstream >(
+    atomic< unsigned > n_reads_done(0);
+    // strand events before and after merging
+    atomic< size_t > n_unmerged_events(0);
+    atomic< size_t > n_merged_events(0);
+    // output of reads done, waiting for the reads before them
+    map< unsigned, string > pending_output;
+    unsigned next_output_rank = 0;
+    Spare_Threads::start_pool(opts::num_threads);
+    pfor::pfor< unsigned, map< unsigned, string > >(
         opts::num_threads,
         opts::chunk_size,
         // get_item
-        [&] (unsigned& i) {
-            if (crt_idx >= reads.size()) return false;
-            i = crt_idx++;
+        [&] (unsigned& g) {
+            if (crt_idx >= read_groups.size())
+            {
+                Spare_Threads::no_more_items();
+                return false;
+            }
+            g = crt_idx++;
+            Spare_Threads::claim();
             return true;
         },
         // process_item
-        [&] (unsigned& i, ostringstream& oss) {
-            Fast5_Summary_Type& read_summary = reads[i];
-            if (read_summary.num_ed_events == 0) return;
-            global_assert::global_msg() = read_summary.read_id;
-            read_summary.load_events();
-
-            // compute read statistics used to check scaling
-            array< pair< FLOAT_TYPE, FLOAT_TYPE >, 2 > r_stats;
-            for (unsigned st = 0; st < 2; ++st)
+        [&] (unsigned& g, map< unsigned, string >& output) {
+            Spare_Threads::Item item;
+            const vector< unsigned >& read_group = read_groups[g];
+            // jobs of each read: model names, and job index per strand
+            static const unsigned no_job = -1;
+            deque< Basecall_Job > jobs;
+            vector< list< pair< array< string, 2 >, array< unsigned, 2 > > > > read_jobs(read_group.size());
+            for (unsigned gi = 0; gi < read_group.size(); ++gi)
             {
-                // if not enough events, ignore strand
-                if (read_summary.events(st).size() < opts::min_ed_events) continue;
-                r_stats[st] = alg::mean_stdv_of< FLOAT_TYPE >(
-                    read_summary.events(st),
-                    [] (const Event_Type& ev) { return ev.mean; });
-                LOG(debug)
-                    << "mean_stdv read [" << read_summary.read_id
-                    << "] strand [" << st
-                    << "] ev_mean=[" << r_stats[st].first
-                    << "] ev_stdv=[" << r_stats[st].second << "]" << endl;
-            }
+                Fast5_Summary_Type& read_summary = reads[read_group[gi]];
+                global_assert::global_msg() = read_summary.read_id;
+                read_summary.load_events();
 
-            // basecalling functor
-            // returns: (path_prob, base_seq)
-            auto basecall_strand = [&] (unsigned st, string m_name,
-                                        const Pore_Model_Parameters_Type& pm_params,
-                                        const State_Transition_Parameters_Type& st_params) {
-                // scale model
-                Pore_Model_Type pm(models.at(m_name));
-                pm.scale(pm_params);
-                State_Transitions_Type custom_transitions;
-                const State_Transitions_Type* transitions_ptr;
-                if (not st_params.is_default())
-                {
-                    custom_transitions.compute_transitions_fast(st_params);
-                    transitions_ptr = &custom_transitions;
-                }
-                else
-                {
-                    transitions_ptr = &default_transitions;
-                }
-                LOG(info)
-                    << "basecalling read [" << read_summary.read_id
-                    << "] strand [" << st
-                    << "] model [" << m_name
-                    << "] pm_params [" << pm_params
-                    << "] st_params [" << st_params << "]" << endl;
-                LOG(debug)
-                    << "mean_stdv read [" << read_summary.read_id
-                    << "] strand [" << st
-                    << "] model_mean [" << pm.mean()
-                    << "] model_stdv [" << pm.stdv() << "]" << endl;
-                if (abs(r_stats[st].first - pm.mean()) > 5.0)
+                // compute read statistics used to check scaling
+                array< pair< FLOAT_TYPE, FLOAT_TYPE >, 2 > r_stats;
+                for (unsigned st = 0; st < 2; ++st)
                 {
-                    LOG(warning)
-                        << "means_apart read [" << read_summary.read_id
+                    // if not enough events, ignore strand
+                    if (read_summary.events(st).size() < opts::min_ed_events) continue;
+                    n_unmerged_events += read_summary.num_unmerged_events[st];
+                    n_merged_events += read_summary.events(st).size();
+                    r_stats[st] = alg::mean_stdv_of< FLOAT_TYPE >(
+                        read_summary.events(st),
+                        [] (const Event_Type& ev) { return ev.mean; });
+                    LOG(debug)
+                        << "mean_stdv read [" << read_summary.read_id
                         << "] strand [" << st
-                        << "] model [" << m_name
-                        << "] parameters [" << pm_params
-                        << "] model_mean=[" << pm.mean()
-                        << "] events_mean=[" << r_stats[st].first
-                        << "]" << endl;
+                        << "] ev_mean=[" << r_stats[st].first
+                        << "] ev_stdv=[" << r_stats[st].second << "]" << endl;
                 }
-                // correct drift
-                Event_Sequence_Type corrected_events = read_summary.events(st);
-                corrected_events.apply_drift_correction(pm_params.drift);
-                Viterbi_Type vit;
-                vit.fill(pm, *transitions_ptr, corrected_events);
-                return std::make_tuple(vit.path_probability(), std::move(corrected_events));
-            };
 
-            if (read_summary.scale_strands_together)
-            {
-                // create list of models to try
-                list< array< string, 2 > > model_sublist;
-                if (not read_summary.preferred_model[2][0].empty())
-                {
-                    // if we have a preferred model, use that
-                    model_sublist.push_back(read_summary.preferred_model[2]);
-                }
-                else
-                {
-                    // no preferred model, try all for which we have scaling parameters
-                    for (const auto& p : read_summary.pm_params_m)
+                // create basecalling job
+                // returns: job index
+                auto add_job = [&] (unsigned st, string m_name,
+                                    const Pore_Model_Parameters_Type& pm_params,
+                                    const State_Transition_Parameters_Type& st_params) {
+                    jobs.emplace_back();
+                    Basecall_Job& job = jobs.back();
+                    job.read_id = read_summary.read_id;
+                    job.st = st;
+                    job.m_name = m_name;
+                    job.log_path_prob = -INFINITY;
+                    job.eliminated = false;
+                    job.decoded = false;
+                    // scale model
+                    job.pm = models.at(m_name);
+                    job.pm.scale(pm_params);
+                    if (not st_params.is_default())
                     {
-                        if (p.first[0].empty() or p.first[1].empty()) continue;
-                        model_sublist.push_back(p.first);
+                        job.custom_transitions.compute_transitions_fast(st_params);
+                        job.transitions_ptr = &job.custom_transitions;
                     }
-                }
-                // basecall using applicable models
-                deque< tuple< FLOAT_TYPE,
-                              FLOAT_TYPE, FLOAT_TYPE,
-                              string, string,
-                              Event_Sequence_Type, Event_Sequence_Type > > results;
-                for (const auto& m_name : model_sublist)
-                {
-                    array< tuple< FLOAT_TYPE, Event_Sequence_Type >, 2 > part_results;
-                    for (unsigned st = 0; st < 2; ++st)
+                    else
                     {
-                        part_results[st] = basecall_strand(
-                            st, m_name[st],
-                            read_summary.pm_params_m.at(m_name),
-                            read_summary.st_params_m.at(m_name)[st]);
+                        job.transitions_ptr = &default_transitions;
                     }
-                    results.emplace_back(get<0>(part_results[0]) + get<0>(part_results[1]),
-                                         get<0>(part_results[0]),
-                                         get<0>(part_results[1]),
-                                         string(m_name[0]),
-                                         string(m_name[1]),
-                                         std::move(get<1>(part_results[0])),
-                                         std::move(get<1>(part_results[1])));
-                }
-                // sort results by first component (log path probability)
-                sort(results.begin(),
-                     results.end(),
-                     [] (const decltype(results)::value_type& lhs, const decltype(results)::value_type& rhs) {
-                         return get<0>(lhs) < get<0>(rhs);
-                     });
-                array< FLOAT_TYPE, 2 > best_log_path_prob{{ get<1>(results.back()), get<2>(results.back()) }};
-                array< string, 2 > best_m_name{{ get<3>(results.back()), get<4>(results.back()) }};
-                array< const Event_Sequence_Type*, 2 > event_seq_ptr = {
-                    &get<5>(results.back()),
-                    &get<6>(results.back())
-                };
-                array< string, 2 > base_seq = {
-                    get<5>(results.back()).get_base_seq(),
-                    get<6>(results.back()).get_base_seq()
-                };
-                string best_m_name_str = best_m_name[0] + '+' + best_m_name[1];
-                auto& best_pm_params = read_summary.pm_params_m.at(best_m_name);
-                auto& best_st_params = read_summary.st_params_m.at(best_m_name);
-                for (unsigned st = 0; st < 2; ++st)
-                {
                     LOG(info)
-                        << "best_model read [" << read_summary.read_id
+                        << "basecalling read [" << read_summary.read_id
                         << "] strand [" << st
-                        << "] model [" << best_m_name[st]
-                        << "] pm_params [" << best_pm_params
-                        << "] st_params [" << best_st_params[st]
-                        << "] log_path_prob [" << best_log_path_prob[st] << "]" << endl;
-                    read_summary.preferred_model[st][st] = best_m_name[st];
-                    read_summary.pm_params_m[read_summary.preferred_model[st]] = best_pm_params;
-                    read_summary.st_params_m[read_summary.preferred_model[st]][st] = best_st_params[st];
-                    string seq_name;
-                    {
-                        ostringstream tmp;
-                        tmp << read_summary.read_id << ":" << read_summary.base_file_name << ":" << st;
-                        seq_name = tmp.str();
-                    }
-                    if (opts::write_fast5)
-                    {
-                        read_summary.add_basecall_seq(seq_name, st, base_seq[st]);
-                        read_summary.add_basecall_events(st, *event_seq_ptr[st]);
-                        read_summary.add_basecall_model(st, models.at(best_m_name[st]));
-                        read_summary.add_basecall_model_params(st, best_pm_params);
-                    }
-                    else
+                        << "] model [" << m_name
+                        << "] pm_params [" << pm_params
+                        << "] st_params [" << st_params << "]" << endl;
+                    LOG(debug)
+                        << "mean_stdv read [" << read_summary.read_id
+                        << "] strand [" << st
+                        << "] model_mean [" << job.pm.mean()
+                        << "] model_stdv [" << job.pm.stdv() << "]" << endl;
+                    if (abs(r_stats[st].first - job.pm.mean()) > 5.0)
                     {
-                        write_fasta(oss, seq_name, base_seq[st]);
+                        LOG(warning)
+                            << "means_apart read [" << read_summary.read_id
+                            << "] strand [" << st
+                            << "] model [" << m_name
+                            << "] parameters [" << pm_params
+                            << "] model_mean=[" << job.pm.mean()
+                            << "] events_mean=[" << r_stats[st].first
+                            << "]" << endl;
                     }
-                }
-            }
-            else // not scale_strands_together
-            {
-                for (unsigned st = 0; st < 2; ++st)
+                    // the scaled model corrects drift; the events copy holds the state path
+                    job.events = read_summary.events(st);
+                    return static_cast< unsigned >(jobs.size() - 1);
+                };
+
+                if (read_summary.scale_strands_together)
                 {
-                    // if not enough events, ignore strand
-                    if (read_summary.events(st).size() < opts::min_ed_events) continue;
                     // create list of models to try
                     list< array< string, 2 > > model_sublist;
-                    if (not read_summary.preferred_model[st][st].empty())
+                    if (not read_summary.preferred_model[2][0].empty())
                     {
                         // if we have a preferred model, use that
-                        model_sublist.push_back(read_summary.preferred_model[st]);
+                        model_sublist.push_back(read_summary.preferred_model[2]);
                     }
                     else
                     {
-                        // no preferred model, try all for which we have scaling
+                        // no preferred model, try all for which we have scaling parameters
                         for (const auto& p : read_summary.pm_params_m)
                         {
-                            if (not p.first[st].empty() and p.first[1 - st].empty())
-                            {
-                                model_sublist.push_back(p.first);
-                            }
+                            if (p.first[0].empty() or p.first[1].empty()) continue;
+                            model_sublist.push_back(p.first);
                         }
                     }
-                    // deque of results
-                    deque< tuple< FLOAT_TYPE, string, Event_Sequence_Type > > results;
                     for (const auto& m_name : model_sublist)
                     {
-                        auto r = basecall_strand(
-                            st, m_name[st],
-                            read_summary.pm_params_m.at(m_name),
-                            read_summary.st_params_m.at(m_name)[st]);
-                        results.emplace_back(get<0>(r),
-                                             string(m_name[st]),
-                                             std::move(get<1>(r)));
+                        array< unsigned, 2 > job_idx;
+                        for (unsigned st = 0; st < 2; ++st)
+                        {
+                            job_idx[st] = add_job(
+                                st, m_name[st],
+                                read_summary.pm_params_m.at(m_name),
+                                read_summary.st_params_m.at(m_name)[st]);
+                        }
+                        read_jobs[gi].emplace_back(m_name, job_idx);
                     }
+                    if (opts::race_chunk_events > 0)
+                    {
+                        vector< array< unsigned, 2 > > candidates;
+                        for (const auto& p : read_jobs[gi])
+                        {
+                            candidates.push_back(p.second);
+                        }
+                        race_basecall_jobs(jobs, candidates);
+                    }
+                }
+                else // not scale_strands_together
+                {
+                    for (unsigned st = 0; st < 2; ++st)
+                    {
+                        // if not enough events, ignore strand
+                        if (read_summary.events(st).size() < opts::min_ed_events) continue;
+                        // create list of models to try
+                        list< array< string, 2 > > model_sublist;
+                        if (not read_summary.preferred_model[st][st].empty())
+                        {
+                            // if we have a preferred model, use that
+                            model_sublist.push_back(read_summary.preferred_model[st]);
+                        }
+                        else
+                        {
+                            // no preferred model, try all for which we have scaling
+                            for (const auto& p : read_summary.pm_params_m)
+                            {
+                                if (not p.first[st].empty() and p.first[1 - st].empty())
+                                {
+                                    model_sublist.push_back(p.first);
+                                }
+                            }
+                        }
+                        for (const auto& m_name : model_sublist)
+                        {
+                            array< unsigned, 2 > job_idx{{ no_job, no_job }};
+                            job_idx[st] = add_job(
+                                st, m_name[st],
+                                read_summary.pm_params_m.at(m_name),
+                                read_summary.st_params_m.at(m_name)[st]);
+                            read_jobs[gi].emplace_back(m_name, job_idx);
+                        }
+                        if (opts::race_chunk_events > 0)
+                        {
+                            vector< array< unsigned, 2 > > candidates;
+                            for (const auto& p : read_jobs[gi])
+                            {
+                                if (p.second[st] == no_job) continue;
+                                candidates.push_back(p.second);
+                            }
+                            race_basecall_jobs(jobs, candidates);
+                        }
+                    } // for st
+                }
+            } // for gi
+
+            run_basecall_jobs(jobs);
+
+            for (unsigned gi = 0; gi < read_group.size(); ++gi)
+            {
+                Fast5_Summary_Type& read_summary = reads[read_group[gi]];
+                global_assert::global_msg() = read_summary.read_id;
+                ostringstream oss;
+                if (read_summary.scale_strands_together)
+                {
+                    // results: (log path probability, model names, job indexes)
+                    deque< tuple< FLOAT_TYPE, array< string, 2 >, array< unsigned, 2 > > > results;
+                    for (const auto& p : read_jobs[gi])
+                    {
+                        if (jobs[p.second[0]].eliminated or jobs[p.second[1]].eliminated) continue;
+                        results.emplace_back(jobs[p.second[0]].log_path_prob + jobs[p.second[1]].log_path_prob,
+                                             p.first, p.second);
+                    }
+                    // sort results by first component (log path probability)
                     sort(results.begin(),
                          results.end(),
                          [] (const decltype(results)::value_type& lhs, const decltype(results)::value_type& rhs) {
                              return get<0>(lhs) < get<0>(rhs);
                          });
-                    const string& best_m_name = get<1>(results.back());
-                    const Event_Sequence_Type& event_seq = get<2>(results.back());
-                    string base_seq = event_seq.get_base_seq();
-                    array< string, 2 > best_m_key;
-                    best_m_key[st] = best_m_name;
-                    LOG(info)
-                        << "best_model read [" << read_summary.read_id
-                        << "] strand [" << st
-                        << "] model [" << best_m_name
-                        << "] pm_params [" << read_summary.pm_params_m.at(best_m_key)
-                        << "] st_params [" << read_summary.st_params_m.at(best_m_key)[st]
-                        << "] log_path_prob [" << get<0>(results.back()) << "]" << endl;
-                    read_summary.preferred_model[st][st] = best_m_name;
-                    string seq_name;
-                    {
-                        ostringstream tmp;
-                        tmp << read_summary.read_id << ":" << read_summary.base_file_name << ":" << st;
-                        seq_name = tmp.str();
-                    }
-                    if (opts::write_fast5)
+                    const array< string, 2 >& best_m_key = get<1>(results.back());
+                    const array< unsigned, 2 >& best_job_idx = get<2>(results.back());
+                    auto& best_pm_params = read_summary.pm_params_m.at(best_m_key);
+                    auto& best_st_params = read_summary.st_params_m.at(best_m_key);
+                    for (unsigned st = 0; st < 2; ++st)
                     {
-                        read_summary.add_basecall_seq(seq_name, st, base_seq);
-                        read_summary.add_basecall_events(st, event_seq);
-                        read_summary.add_basecall_model(st, models.at(best_m_name));
-                        read_summary.add_basecall_model_params(st, read_summary.pm_params_m.at(best_m_key));
+                        Basecall_Job& job = jobs[best_job_idx[st]];
+                        string base_seq = job.events.get_base_seq();
+                        LOG(info)
+                            << "best_model read [" << read_summary.read_id
+                            << "] strand [" << st
+                            << "] model [" << job.m_name
+                            << "] pm_params [" << best_pm_params
+                            << "] st_params [" << best_st_params[st]
+                            << "] log_path_prob [" << job.log_path_prob << "]" << endl;
+                        read_summary.preferred_model[st][st] = job.m_name;
+                        read_summary.pm_params_m[read_summary.preferred_model[st]] = best_pm_params;
+                        read_summary.st_params_m[read_summary.preferred_model[st]][st] = best_st_params[st];
+                        string seq_name;
+                        {
+                            ostringstream tmp;
+                            tmp << read_summary.read_id << ":" << read_summary.base_file_name << ":" << st;
+                            seq_name = tmp.str();
+                        }
+                        if (opts::write_fast5)
+                        {
+                            read_summary.add_basecall_seq(seq_name, st, base_seq);
+                            job.events.fill_model_states();
+                            job.events.apply_drift_correction(job.pm.drift());
+                            read_summary.add_basecall_events(st, job.events);
+                            read_summary.add_basecall_model(st, models.at(job.m_name));
+                            read_summary.add_basecall_model_params(st, best_pm_params);
+                        }
+                        else
+                        {
+                            write_fasta(oss, seq_name, base_seq);
+                        }
                     }
-                    else
+                }
+                else // not scale_strands_together
+                {
+                    for (unsigned st = 0; st < 2; ++st)
                     {
-                        write_fasta(oss, seq_name, base_seq);
-                    }
-                } // for st
-            }
-            read_summary.drop_events();
+                        // results: (log path probability, job index)
+                        deque< pair< FLOAT_TYPE, unsigned > > results;
+                        for (const auto& p : read_jobs[gi])
+                        {
+                            if (p.second[st] == no_job or jobs[p.second[st]].eliminated) continue;
+                            results.emplace_back(jobs[p.second[st]].log_path_prob, p.second[st]);
+                        }
+                        if (results.empty()) continue;
+                        sort(results.begin(),
+                             results.end(),
+                             [] (const decltype(results)::value_type& lhs, const decltype(results)::value_type& rhs) {
+                                 return lhs.first < rhs.first;
+                             });
+                        Basecall_Job& job = jobs[results.back().second];
+                        const string& best_m_name = job.m_name;
+                        string base_seq = job.events.get_base_seq();
+                        array< string, 2 > best_m_key;
+                        best_m_key[st] = best_m_name;
+                        LOG(info)
+                            << "best_model read [" << read_summary.read_id
+                            << "] strand [" << st
+                            << "] model [" << best_m_name
+                            << "] pm_params [" << read_summary.pm_params_m.at(best_m_key)
+                            << "] st_params [" << read_summary.st_params_m.at(best_m_key)[st]
+                            << "] log_path_prob [" << job.log_path_prob << "]" << endl;
+                        read_summary.preferred_model[st][st] = best_m_name;
+                        string seq_name;
+                        {
+                            ostringstream tmp;
+                            tmp << read_summary.read_id << ":" << read_summary.base_file_name << ":" << st;
+                            seq_name = tmp.str();
+                        }
+                        if (opts::write_fast5)
+                        {
+                            read_summary.add_basecall_seq(seq_name, st, base_seq);
+                            job.events.fill_model_states();
+                            job.events.apply_drift_correction(job.pm.drift());
+                            read_summary.add_basecall_events(st, job.events);
+                            read_summary.add_basecall_model(st, models.at(best_m_name));
+                            read_summary.add_basecall_model_params(st, read_summary.pm_params_m.at(best_m_key));
+                        }
+                        else
+                        {
+                            write_fasta(oss, seq_name, base_seq);
+                        }
+                    } // for st
+                }
+                read_summary.drop_events();
+                output[read_rank[read_group[gi]]] = oss.str();
+                ++n_reads_done;
+            } // for gi
         },
         // output_chunk
-        [&] (ostringstream& oss) {
-            *os_p << oss.str();
+        [&] (map< unsigned, string >& output) {
+            pending_output.insert(output.begin(), output.end());
+            output.clear();
+            while (not pending_output.empty() and pending_output.begin()->first == next_output_rank)
+            {
+                *os_p << pending_output.begin()->second;
+                pending_output.erase(pending_output.begin());
+                ++next_output_rank;
+            }
         },
         // progress_report
-        [&] (unsigned items, unsigned seconds) {
-            clog << "Processed " << setw(6) << right << items << " reads in "
+        [&] (unsigned, unsigned seconds) {
+            clog << "Processed " << setw(6) << right << n_reads_done.load() << " reads in "
                  << setw(6) << right << seconds << " seconds\r";
         }); // pfor
+    Spare_Threads::end_pool();
+    if (opts::merge_events_t > 0.0 and n_merged_events > 0)
+    {
+        LOG(info)
+            << "merge_events events [" << n_unmerged_events.load()
+            << "] merged [" << n_merged_events.load()
+            << "] reduction_ratio [" << (double)n_unmerged_events.load() / n_merged_events.load() << "]" << endl;
+    }
     auto time_end_ms = get_cpu_time_ms();
     LOG(info) << "basecalling user_cpu_secs=" << (time_end_ms - time_start_ms)/1000 << endl;
 } // basecall_reads
@@ -924,7 +1320,65 @@ int main(int argc, char * argv[])
     State_Transition_Parameters_Type::default_p_skip() = opts::pr_skip;
     Fast5_Summary_Type::min_ed_events() = opts::min_ed_events;
     Fast5_Summary_Type::max_ed_events() = opts::max_ed_events;
+    Fast5_Summary_Type::merge_events_max_t() = opts::merge_events_t;
     Fast5_Summary_Type::eventdetection_group() = opts::ed_group;
+    DP_Arena::max_cached_bytes() = size_t(opts::dp_arena_mb) << 20;
+    DP_Arena::huge_pages() = opts::huge_pages;
+    Viterbi_Type::n_threads() = opts::num_threads;
+    Viterbi_Type::parallel_min_events() = opts::viterbi_parallel_events;
+    Viterbi_Type::checkpoint_min_events() = opts::viterbi_checkpoint_events;
+    Viterbi_Type::checkpoint_interval() = opts::viterbi_checkpoint_interval;
+    Windowed_Viterbi_Type::n_threads() = opts::num_threads;
+    if (not (opts::viterbi_int16_scale > 0))
+    {
+        LOG(error) << "viterbi-int16-scale must be positive" << endl;
+        return EXIT_FAILURE;
+    }
+    Viterbi_Int16_Type::score_scale() = opts::viterbi_int16_scale;
+    if (opts::sparse_emission_stdvs < 0)
+    {
+        LOG(error) << "sparse-emission-stdvs must not be negative" << endl;
+        return EXIT_FAILURE;
+    }
+    Pore_Model_Type::sparse_emission_stdvs() = opts::sparse_emission_stdvs;
+    if (not Log_Sum_Exp_Type::valid_exp_degree(opts::log_sum_exp_degree))
+    {
+        LOG(error) << "log-sum-exp-degree must be 0, or between 2 and " << Log_Sum_Exp_Type::max_exp_degree << endl;
+        return EXIT_FAILURE;
+    }
+    Log_Sum_Exp_Type::exp_degree() = opts::log_sum_exp_degree;
+    Emission_Matrix_Type::max_mb() = opts::emission_matrix_mb;
+    Windowed_Viterbi_Type::window_events() = opts::viterbi_window_events;
+    Windowed_Viterbi_Type::window_overlap() = opts::viterbi_window_overlap;
+    if (opts::beam.get() == "none")
+    {
+        Viterbi_Type::beam_mode() = Viterbi_Type::no_beam;
+    }
+    else if (opts::beam.get() == "width")
+    {
+        Viterbi_Type::beam_mode() = Viterbi_Type::fixed_beam;
+    }
+    else if (opts::beam.get() == "threshold")
+    {
+        Viterbi_Type::beam_mode() = Viterbi_Type::threshold_beam;
+    }
+    else if (opts::beam.get() == "adaptive")
+    {
+        Viterbi_Type::beam_mode() = Viterbi_Type::adaptive_beam;
+    }
+    else
+    {
+        LOG(error) << "beam not understood: " << opts::beam.get() << endl;
+        return EXIT_FAILURE;
+    }
+    if (opts::beam_width == 0)
+    {
+        LOG(error) << "beam-width must be positive" << endl;
+        return EXIT_FAILURE;
+    }
+    Viterbi_Type::beam_width() = opts::beam_width;
+    Viterbi_Type::beam_max_width() = opts::beam_max_width;
+    Viterbi_Type::beam_threshold() = opts::beam_threshold;
     Fast5_Summary_Type::template_only() = opts::template_only;
     Fast5_Summary_Type::trim_margins() = {{ opts::trim_ed_sq_start, opts::trim_ed_sq_end, opts::trim_ed_hp_start, opts::trim_ed_hp_end }};
     LOG (info) << "eventdetection_group=" << (Fast5_Summary_Type::eventdetection_group().empty()
@@ -968,6 +1422,7 @@ int main(int argc, char * argv[])
         return EXIT_FAILURE;
     }
     Parameter_Trainer_Type::pm_train_drift() = opts::train_drift.get() == "1";
+    Parameter_Trainer_Type::posterior_mass() = opts::posterior_mass;
     LOG(info)
         << "ed_event_trimming: "
         << " sq_start=" << Fast5_Summary_Type::trim_margins()[0]
@@ -1051,6 +1506,12 @@ int main(int argc, char * argv[])
             << "invalid scaling_min_progress: " << opts::scaling_min_progress.get() << endl;
         return EXIT_FAILURE;
     }
+    if (not (opts::posterior_mass > 0.0 and opts::posterior_mass <= 1.0))
+    {
+        LOG(error)
+            << "invalid posterior_mass: " << opts::posterior_mass.get() << endl;
+        return EXIT_FAILURE;
+    }
     if (not opts::output_fn.get().empty() and opts::write_fast5)
     {
         LOG(error)
@@ -1074,6 +1535,7 @@ int main(int argc, char * argv[])
             LOG(info) << "scaling_select_threshold=" << opts::scaling_select_threshold.get() << endl;
             LOG(info) << "train_drift=" << opts::train_drift.get() << endl;
         }
+        LOG(info) << "posterior_mass=" << opts::posterior_mass.get() << endl;
     }
     LOG(info) << "basecall=" << opts::basecall.get() << endl;
     return real_main();
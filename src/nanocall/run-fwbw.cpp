@@ -7,6 +7,7 @@
 #include "Event.hpp"
 #include "Forward_Backward.hpp"
 #include "Forward_Backward_Custom.hpp"
+#include "thread_support.hpp"
 #include "logger.hpp"
 #include "zstr.hpp"
 
@@ -38,6 +39,9 @@ namespace opts
     ValueArg< string > ev_file_name("e", "events", "Events file name.", true, "", "file", cmd_parser);
     ValueArg< string > output_file_name("o", "output", "Output file name.", false, "", "file", cmd_parser);
     SwitchArg custom_fwbw("", "custom-fwbw", "Use custom fwbw.", cmd_parser);
+    SwitchArg log_space_fwbw("", "log-space-fwbw", "Run fwbw in log space.", cmd_parser);
+    ValueArg< unsigned > n_threads("t", "threads", "Run the forward and backward passes on 2 threads if greater than 1.", false, 1, "int", cmd_parser);
+    SwitchArg stream_fwbw("", "stream-fwbw", "Stream fwbw posteriors from checkpoints, without keeping the matrix.", cmd_parser);
 } // namespace opts
 
 void real_main()
@@ -57,9 +61,20 @@ void real_main()
         }
     }
 
+    Forward_Backward_Type::linear_space() = not opts::log_space_fwbw;
+    Forward_Backward_Type::n_threads() = opts::n_threads;
+    Forward_Backward_Type::parallel_min_events() = 1;
+    Spare_Threads::set_n_threads(opts::n_threads);
     Forward_Backward_Type fwbw;
     Forward_Backward_Custom_Type fwbw_custom;
-    if (not opts::custom_fwbw)
+    vector< FLOAT_TYPE > mid_posterior(pm.n_states);
+    if (opts::stream_fwbw)
+    {
+        fwbw.stream_posteriors(pm, st, ev, [&] (unsigned i, const FLOAT_TYPE* p) {
+            if (i == ev.size() / 2) copy_n(p, pm.n_states, mid_posterior.begin());
+        });
+    }
+    else if (not opts::custom_fwbw)
     {
         fwbw.fill(pm, st, ev);
     }
@@ -72,9 +87,11 @@ void real_main()
     multiset< pair< FLOAT_TYPE, unsigned > > s;
     for (unsigned j = 0; j < pm.n_states; ++j)
     {
-        FLOAT_TYPE v = exp(not opts::custom_fwbw
-                           ? fwbw.log_posterior(ev.size() / 2, j)
-                           : fwbw_custom.log_posterior(ev.size() / 2, j));
+        FLOAT_TYPE v = (opts::stream_fwbw
+                        ? mid_posterior[j]
+                        : exp(not opts::custom_fwbw
+                              ? fwbw.log_posterior(ev.size() / 2, j)
+                              : fwbw_custom.log_posterior(ev.size() / 2, j)));
         if (v >= .1)
         {
             s.insert(make_pair(v, j));
@@ -87,7 +104,8 @@ void real_main()
         s.erase(it);
     }
 
-    if (not opts::output_file_name.get().empty())
+    // the matrix is not kept by --stream-fwbw
+    if (not opts::output_file_name.get().empty() and not opts::stream_fwbw)
     {
         strict_fstream::ofstream(opts::output_file_name) << fwbw;
     }
@@ -6,6 +6,7 @@
 #include "State_Transitions.hpp"
 #include "Event.hpp"
 #include "Viterbi.hpp"
+#include "Online_Viterbi.hpp"
 #include "logger.hpp"
 #include "zstr.hpp"
 
@@ -22,6 +23,7 @@ typedef Pore_Model< FLOAT_TYPE, KMER_SIZE > Pore_Model_Type;
 typedef Event< FLOAT_TYPE, KMER_SIZE > Event_Type;
 typedef Event_Sequence< FLOAT_TYPE, KMER_SIZE > Event_Sequence_Type;
 typedef Viterbi< FLOAT_TYPE, KMER_SIZE > Viterbi_Type;
+typedef Online_Viterbi< FLOAT_TYPE, KMER_SIZE > Online_Viterbi_Type;
 
 namespace opts
 {
@@ -33,6 +35,8 @@ namespace opts
     ValueArg< string > pm_file_name("p", "pore-model", "Scaled pore model file name.", true, "", "file", cmd_parser);
     ValueArg< string > st_file_name("s", "state-transitions", "State transitions file name.", true, "", "file", cmd_parser);
     ValueArg< string > ev_file_name("e", "events", "Events file name.", true, "", "file", cmd_parser);
+    ValueArg< unsigned > online_max_lag("", "online-max-lag", "Maximum number of uncommitted events in online mode (0: no limit).", false, 1000, "int", cmd_parser);
+    SwitchArg online("", "online", "Decode events as they are read, printing bases once they are final.", cmd_parser);
 } // namespace opts
 
 void real_main()
@@ -42,6 +46,23 @@ void real_main()
     Event_Sequence_Type ev;
     zstr::ifstream(opts::pm_file_name) >> pm;
     zstr::ifstream(opts::st_file_name) >> st;
+    if (opts::online)
+    {
+        Online_Viterbi_Type::max_lag() = opts::online_max_lag;
+        Online_Viterbi_Type ovit(pm, st);
+        zstr::ifstream ifs(opts::ev_file_name);
+        Event_Type e;
+        while (ifs >> e)
+        {
+            if (ovit.push(e) > 0)
+            {
+                cout << ovit.take_bases() << std::flush;
+            }
+        }
+        ovit.finish();
+        cout << ovit.take_bases() << std::endl;
+        return;
+    }
     {
         zstr::ifstream ifs(opts::ev_file_name);
         Event_Type e;
@@ -0,0 +1,197 @@
+#ifndef __SIMD_SUPPORT_HPP
+#define __SIMD_SUPPORT_HPP
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+
+#if defined(__AVX__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+/*
+ * Minimal SIMD wrappers used by the DP kernels.
+ *
+ * simd::Vec< Float_Type > packs simd::Vec< Float_Type >::width values.
+ * The generic version is scalar; float uses AVX (8 lanes) or SSE2 (4 lanes),
+ * depending on what the compiler is allowed to generate (e.g. -mavx2).
+ * Kernels are written against this interface and must process states
+ * in blocks that are a multiple of the largest width (8), or finish
+ * ragged ranges with simd::Scalar_Vec.
+ *
+ * simd::Vec< int16_t > holds saturating 16-bit integer scores: add and sub clamp
+ * to [-32768, 32767] instead of wrapping. It uses AVX2 (16 lanes) or SSE2 (8 lanes).
+ */
+namespace simd
+{
+
+template < typename Float_Type >
+struct Scalar_Vec
+{
+    typedef Float_Type type;
+    static const unsigned width = 1;
+
+    static type load(const Float_Type* p) { return *p; }
+    static void store(Float_Type* p, type a) { *p = a; }
+    static type set1(Float_Type v) { return v; }
+    static type add(type a, type b) { return a + b; }
+    static type sub(type a, type b) { return a - b; }
+    static type mul(type a, type b) { return a * b; }
+    static type div(type a, type b) { return a / b; }
+    static type max(type a, type b) { return std::max(a, b); }
+    // gt: mask of lanes where a > b
+    static type gt(type a, type b) { return a > b? 1 : 0; }
+    // blend: lanes of a where mask is set, lanes of b elsewhere
+    static type blend(type mask, type a, type b) { return mask != 0? a : b; }
+    // round: to nearest integer
+    static type round(type a) { return std::nearbyint(a); }
+    // pow2i: 2^a, for lanes holding integers in [-126, 127]
+    static type pow2i(type a) { return std::ldexp(Float_Type(1), static_cast< int >(a)); }
+    // store_u8: truncate lanes holding small non-negative integers, and store them as bytes
+    static void store_u8(uint8_t* p, type a) { *p = static_cast< uint8_t >(a); }
+}; // struct Scalar_Vec
+
+template <>
+struct Scalar_Vec< int16_t >
+{
+    typedef int16_t type;
+    static const unsigned width = 1;
+
+    static type load(const int16_t* p) { return *p; }
+    static void store(int16_t* p, type a) { *p = a; }
+    static type set1(int16_t v) { return v; }
+    static type add(type a, type b) { return saturate(static_cast< int >(a) + b); }
+    static type sub(type a, type b) { return saturate(static_cast< int >(a) - b); }
+    static type max(type a, type b) { return std::max(a, b); }
+    static type gt(type a, type b) { return a > b? -1 : 0; }
+    static type blend(type mask, type a, type b) { return mask != 0? a : b; }
+    static void store_u8(uint8_t* p, type a) { *p = static_cast< uint8_t >(a); }
+    static type saturate(int v) { return static_cast< type >(std::min(std::max(v, -32768), 32767)); }
+}; // struct Scalar_Vec< int16_t >
+
+template < typename Float_Type >
+struct Vec
+    : public Scalar_Vec< Float_Type >
+{}; // struct Vec
+
+#if defined(__AVX__)
+
+template <>
+struct Vec< float >
+{
+    typedef __m256 type;
+    static const unsigned width = 8;
+
+    static type load(const float* p) { return _mm256_loadu_ps(p); }
+    static void store(float* p, type a) { _mm256_storeu_ps(p, a); }
+    static type set1(float v) { return _mm256_set1_ps(v); }
+    static type add(type a, type b) { return _mm256_add_ps(a, b); }
+    static type sub(type a, type b) { return _mm256_sub_ps(a, b); }
+    static type mul(type a, type b) { return _mm256_mul_ps(a, b); }
+    static type div(type a, type b) { return _mm256_div_ps(a, b); }
+    static type max(type a, type b) { return _mm256_max_ps(a, b); }
+    static type gt(type a, type b) { return _mm256_cmp_ps(a, b, _CMP_GT_OQ); }
+    static type blend(type mask, type a, type b) { return _mm256_blendv_ps(b, a, mask); }
+    static type round(type a) { return _mm256_round_ps(a, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC); }
+    static type pow2i(type a)
+    {
+        __m256i i = _mm256_cvtps_epi32(a);
+#if defined(__AVX2__)
+        i = _mm256_slli_epi32(_mm256_add_epi32(i, _mm256_set1_epi32(127)), 23);
+#else
+        __m128i lo = _mm_slli_epi32(_mm_add_epi32(_mm256_castsi256_si128(i), _mm_set1_epi32(127)), 23);
+        __m128i hi = _mm_slli_epi32(_mm_add_epi32(_mm256_extractf128_si256(i, 1), _mm_set1_epi32(127)), 23);
+        i = _mm256_insertf128_si256(_mm256_castsi128_si256(lo), hi, 1);
+#endif
+        return _mm256_castsi256_ps(i);
+    }
+    static void store_u8(uint8_t* p, type a)
+    {
+        __m256i i = _mm256_cvttps_epi32(a);
+        __m128i w = _mm_packs_epi32(_mm256_castsi256_si128(i), _mm256_extractf128_si256(i, 1));
+        _mm_storel_epi64(reinterpret_cast< __m128i* >(p), _mm_packus_epi16(w, w));
+    }
+}; // struct Vec< float >
+
+#elif defined(__SSE2__)
+
+template <>
+struct Vec< float >
+{
+    typedef __m128 type;
+    static const unsigned width = 4;
+
+    static type load(const float* p) { return _mm_loadu_ps(p); }
+    static void store(float* p, type a) { _mm_storeu_ps(p, a); }
+    static type set1(float v) { return _mm_set1_ps(v); }
+    static type add(type a, type b) { return _mm_add_ps(a, b); }
+    static type sub(type a, type b) { return _mm_sub_ps(a, b); }
+    static type mul(type a, type b) { return _mm_mul_ps(a, b); }
+    static type div(type a, type b) { return _mm_div_ps(a, b); }
+    static type max(type a, type b) { return _mm_max_ps(a, b); }
+    static type gt(type a, type b) { return _mm_cmpgt_ps(a, b); }
+    static type blend(type mask, type a, type b) { return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b)); }
+    // no SSE4.1 round: convert with the default rounding mode (to nearest)
+    static type round(type a) { return _mm_cvtepi32_ps(_mm_cvtps_epi32(a)); }
+    static type pow2i(type a)
+    {
+        return _mm_castsi128_ps(_mm_slli_epi32(_mm_add_epi32(_mm_cvtps_epi32(a), _mm_set1_epi32(127)), 23));
+    }
+    static void store_u8(uint8_t* p, type a)
+    {
+        __m128i w = _mm_packs_epi32(_mm_cvttps_epi32(a), _mm_setzero_si128());
+        int32_t v = _mm_cvtsi128_si32(_mm_packus_epi16(w, w));
+        std::memcpy(p, &v, sizeof(v));
+    }
+}; // struct Vec< float >
+
+#endif
+
+#if defined(__AVX2__)
+
+template <>
+struct Vec< int16_t >
+{
+    typedef __m256i type;
+    static const unsigned width = 16;
+
+    static type load(const int16_t* p) { return _mm256_loadu_si256(reinterpret_cast< const __m256i* >(p)); }
+    static void store(int16_t* p, type a) { _mm256_storeu_si256(reinterpret_cast< __m256i* >(p), a); }
+    static type set1(int16_t v) { return _mm256_set1_epi16(v); }
+    static type add(type a, type b) { return _mm256_adds_epi16(a, b); }
+    static type sub(type a, type b) { return _mm256_subs_epi16(a, b); }
+    static type max(type a, type b) { return _mm256_max_epi16(a, b); }
+    static type gt(type a, type b) { return _mm256_cmpgt_epi16(a, b); }
+    static type blend(type mask, type a, type b) { return _mm256_blendv_epi8(b, a, mask); }
+    static void store_u8(uint8_t* p, type a)
+    {
+        __m128i v = _mm_packus_epi16(_mm256_castsi256_si128(a), _mm256_extracti128_si256(a, 1));
+        _mm_storeu_si128(reinterpret_cast< __m128i* >(p), v);
+    }
+}; // struct Vec< int16_t >
+
+#elif defined(__SSE2__)
+
+template <>
+struct Vec< int16_t >
+{
+    typedef __m128i type;
+    static const unsigned width = 8;
+
+    static type load(const int16_t* p) { return _mm_loadu_si128(reinterpret_cast< const __m128i* >(p)); }
+    static void store(int16_t* p, type a) { _mm_storeu_si128(reinterpret_cast< __m128i* >(p), a); }
+    static type set1(int16_t v) { return _mm_set1_epi16(v); }
+    static type add(type a, type b) { return _mm_adds_epi16(a, b); }
+    static type sub(type a, type b) { return _mm_subs_epi16(a, b); }
+    static type max(type a, type b) { return _mm_max_epi16(a, b); }
+    static type gt(type a, type b) { return _mm_cmpgt_epi16(a, b); }
+    static type blend(type mask, type a, type b) { return _mm_or_si128(_mm_and_si128(mask, a), _mm_andnot_si128(mask, b)); }
+    static void store_u8(uint8_t* p, type a) { _mm_storel_epi64(reinterpret_cast< __m128i* >(p), _mm_packus_epi16(a, a)); }
+}; // struct Vec< int16_t >
+
+#endif
+
+} // namespace simd
+
+#endif
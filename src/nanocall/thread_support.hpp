@@ -0,0 +1,159 @@
+#ifndef __THREAD_SUPPORT_HPP
+#define __THREAD_SUPPORT_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/*
+ * A team of threads working in lockstep on a shared task.
+ *
+ * run(f) calls f(tid) on size() threads, the calling thread being tid 0,
+ * and returns when all calls are done. Inside f, barrier() blocks until
+ * all threads in the team reach it. Waiting threads spin briefly, then
+ * yield, so the barrier stays cheap when each step takes microseconds.
+ */
+class Thread_Team
+{
+public:
+    explicit Thread_Team(unsigned n) : _n(n > 0? n : 1), _count(0), _generation(0) {}
+
+    unsigned size() const { return _n; }
+
+    template < typename Function >
+    void run(Function&& f)
+    {
+        std::vector< std::thread > thread_v;
+        for (unsigned tid = 1; tid < _n; ++tid)
+        {
+            thread_v.emplace_back([&f, tid] () { f(tid); });
+        }
+        f(0);
+        for (auto& t : thread_v)
+        {
+            t.join();
+        }
+    }
+
+    void barrier()
+    {
+        static const unsigned max_spins = 1u << 12;
+        unsigned generation = _generation.load(std::memory_order_acquire);
+        if (_count.fetch_add(1, std::memory_order_acq_rel) + 1 == _n)
+        {
+            _count.store(0, std::memory_order_relaxed);
+            _generation.fetch_add(1, std::memory_order_release);
+        }
+        else
+        {
+            unsigned spins = 0;
+            while (_generation.load(std::memory_order_acquire) == generation)
+            {
+                if (++spins > max_spins)
+                {
+                    std::this_thread::yield();
+                }
+            }
+        }
+    }
+
+private:
+    const unsigned _n;
+    std::atomic< unsigned > _count;
+    std::atomic< unsigned > _generation;
+}; // class Thread_Team
+
+/*
+ * Threads left idle by the outer worker pool, which nested teams may borrow.
+ *
+ * A pool of n threads working through a list of items calls start_pool(n), claim()
+ * for every item it hands out, finish() when an item is done, no_more_items() once
+ * the list is exhausted, and end_pool() after its threads are joined. Until the list
+ * is exhausted, all threads of the pool are assumed busy. After, every thread not
+ * holding an unfinished item is idle, and a Loan hands it to a nested team until
+ * the loan is destroyed. Outside of a pool, all the threads given to set_n_threads()
+ * but the calling one may be borrowed.
+ */
+class Spare_Threads
+{
+public:
+    static void start_pool(unsigned n)
+    {
+        std::lock_guard< std::mutex > lock(state().mutex);
+        state().n_threads = n;
+        state().n_items = 0;
+        state().open = false;
+    }
+    static void end_pool()
+    {
+        std::lock_guard< std::mutex > lock(state().mutex);
+        state().n_items = 1;
+        state().open = true;
+    }
+    static void claim() { std::lock_guard< std::mutex > lock(state().mutex); ++state().n_items; }
+    static void finish() { std::lock_guard< std::mutex > lock(state().mutex); --state().n_items; }
+    static void no_more_items() { std::lock_guard< std::mutex > lock(state().mutex); state().open = true; }
+
+    // threads available outside of a pool, including the calling thread
+    static void set_n_threads(unsigned n) { std::lock_guard< std::mutex > lock(state().mutex); state().n_threads = n; }
+
+    // up to n idle threads, given back on destruction
+    class Loan
+    {
+    public:
+        explicit Loan(unsigned n) : _n(borrow(n)) {}
+        ~Loan() { give_back(_n); }
+        Loan(const Loan&) = delete;
+        Loan& operator = (const Loan&) = delete;
+
+        unsigned size() const { return _n; }
+
+    private:
+        const unsigned _n;
+    }; // class Loan
+
+    // marks the calling worker's item finished on destruction
+    class Item
+    {
+    public:
+        Item() = default;
+        ~Item() { finish(); }
+        Item(const Item&) = delete;
+        Item& operator = (const Item&) = delete;
+    }; // class Item
+
+private:
+    struct State
+    {
+        std::mutex mutex;
+        unsigned n_threads = 1;
+        // unfinished items, or the calling thread outside of a pool
+        unsigned n_items = 1;
+        unsigned n_lent = 0;
+        // set when idle threads stay idle
+        bool open = true;
+    };
+
+    static State& state() { static State _state; return _state; }
+
+    static unsigned borrow(unsigned n)
+    {
+        if (n == 0) return 0;
+        std::lock_guard< std::mutex > lock(state().mutex);
+        State& s = state();
+        if (not s.open or s.n_items + s.n_lent >= s.n_threads) return 0;
+        unsigned k = std::min(n, s.n_threads - s.n_items - s.n_lent);
+        s.n_lent += k;
+        return k;
+    }
+    static void give_back(unsigned n)
+    {
+        if (n == 0) return;
+        std::lock_guard< std::mutex > lock(state().mutex);
+        state().n_lent -= n;
+    }
+}; // class Spare_Threads
+
+#endif